@@ -0,0 +1,642 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "flat_hash_set.hpp"
+#include "flat_hash_map.hpp"
+#include "flat_incremental_hash_map.hpp"
+#include "flat_concurrent_hash_map.hpp"
+#include "flat_read_mostly_hash_map.hpp"
+#include "flat_parallel_build.hpp"
+#include "flat_frozen_hash_map.hpp"
+#include "flat_huge_page_allocator.hpp"
+
+// Benchmarks hash_map / hash_set against std::unordered_map /
+// std::unordered_set.  Every result is printed as one CSV line:
+//
+//   container,key,op,size,buckets_load,ns_per_op
+//
+// Keys are generated from a fixed seed, so two runs with the same arguments
+// operate on exactly the same key sets.
+
+struct Blob64 {
+  uint64_t words[8];
+
+  bool operator==(Blob64 const& rhs) const {
+    return std::memcmp(words, rhs.words, sizeof(words)) == 0;
+  }
+};
+
+struct Options {
+  size_t minSize = 1 << 8;
+  size_t maxSize = 1 << 22;
+  size_t repeat = 3;
+  uint64_t seed = 0;
+  std::string filter;
+};
+
+static volatile size_t g_sink;
+
+// splitmix64, a bijection on 64 bit integers, so distinct indexes always
+// produce distinct keys.
+uint64_t mix_index(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+namespace std {
+  template <>
+  struct hash<Blob64> {
+    size_t operator()(Blob64 const& b) const {
+      uint64_t h = 0;
+      for (auto w : b.words)
+        h = mix_index(h ^ w);
+      return (size_t)h;
+    }
+  };
+}
+
+template <typename Key>
+struct KeyGen;
+
+template <>
+struct KeyGen<int> {
+  static char const* name() { return "int"; }
+  // The low 32 bits of splitmix64 are not a bijection, so use a 32 bit
+  // multiply / xorshift mix instead.
+  static int make(uint64_t i, uint64_t seed) {
+    uint32_t x = (uint32_t)(i + seed * 0x9e3779b9u);
+    x = (x ^ (x >> 16)) * 0x7feb352du;
+    x = (x ^ (x >> 15)) * 0x846ca68bu;
+    return (int)(x ^ (x >> 16));
+  }
+};
+
+template <>
+struct KeyGen<uint64_t> {
+  static char const* name() { return "uint64"; }
+  static uint64_t make(uint64_t i, uint64_t seed) {
+    return mix_index(i ^ (seed * 0xd1b54a32d192ed03ull));
+  }
+};
+
+template <>
+struct KeyGen<std::string> {
+  static char const* name() { return "string"; }
+  // 24 characters, long enough to defeat the small string optimization.
+  static std::string make(uint64_t i, uint64_t seed) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key:%016llx:pad", (unsigned long long)KeyGen<uint64_t>::make(i, seed));
+    return buf;
+  }
+};
+
+template <>
+struct KeyGen<Blob64> {
+  static char const* name() { return "blob64"; }
+  static Blob64 make(uint64_t i, uint64_t seed) {
+    Blob64 b;
+    b.words[0] = KeyGen<uint64_t>::make(i, seed);
+    for (size_t w = 1; w < 8; ++w)
+      b.words[w] = b.words[w - 1] * 0x9e3779b97f4a7c15ull;
+    return b;
+  }
+};
+
+template <typename Key>
+struct KeySets {
+  KeySets(size_t size, uint64_t seed) {
+    hits.reserve(size);
+    misses.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+      hits.push_back(KeyGen<Key>::make(i, seed));
+      misses.push_back(KeyGen<Key>::make(i + size, seed));
+    }
+  }
+
+  std::vector<Key> hits;
+  std::vector<Key> misses;
+};
+
+template <typename Function>
+double time_ns_per_op(Options const& options, size_t ops, Function&& function) {
+  double best = 0.0;
+  for (size_t r = 0; r < options.repeat; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (double)(ops == 0 ? 1 : ops);
+    if (r == 0 || ns < best)
+      best = ns;
+  }
+  return best;
+}
+
+void report(char const* container, char const* key, char const* op, size_t size, double load, double ns) {
+  std::printf("%s,%s,%s,%zu,%.3f,%.3f\n", container, key, op, size, load, ns);
+  std::fflush(stdout);
+}
+
+// The flat tables always use a power of two bucket count, the "load" column
+// is the fraction of that bucket count in use, which tells how close to
+// MaxFillLevel a given size lands.
+double flat_load(size_t size) {
+  size_t buckets = 8;
+  while ((double)size / (double)buckets > 0.7)
+    buckets *= 2;
+  return (double)size / (double)buckets;
+}
+
+template <typename Set>
+void bench_set(Options const& options, char const* container, char const* keyName, KeySets<typename Set::key_type> const& keys) {
+  typedef typename Set::key_type Key;
+  size_t size = keys.hits.size();
+  double load = flat_load(size);
+
+  report(container, keyName, "insert", size, load, time_ns_per_op(options, size, [&]() {
+      Set set;
+      for (auto const& k : keys.hits)
+        set.insert(k);
+      g_sink = g_sink + set.size();
+    }));
+
+  report(container, keyName, "insert_reserved", size, load, time_ns_per_op(options, size, [&]() {
+      Set set;
+      set.reserve(size);
+      for (auto const& k : keys.hits)
+        set.insert(k);
+      g_sink = g_sink + set.size();
+    }));
+
+  Set set(keys.hits.begin(), keys.hits.end());
+
+  report(container, keyName, "find_hit", size, load, time_ns_per_op(options, size, [&]() {
+      size_t found = 0;
+      for (auto const& k : keys.hits)
+        found += set.find(k) != set.end();
+      g_sink = g_sink + found;
+    }));
+
+  report(container, keyName, "find_miss", size, load, time_ns_per_op(options, size, [&]() {
+      size_t found = 0;
+      for (auto const& k : keys.misses)
+        found += set.find(k) != set.end();
+      g_sink = g_sink + found;
+    }));
+
+  report(container, keyName, "iterate", size, load, time_ns_per_op(options, size, [&]() {
+      size_t count = 0;
+      for (Key const& k : set) {
+        (void)k;
+        ++count;
+      }
+      g_sink = g_sink + count;
+    }));
+
+  report(container, keyName, "rehash", size, load, time_ns_per_op(options, size, [&]() {
+      Set copy(set);
+      copy.reserve(size * 2);
+      g_sink = g_sink + copy.size();
+    }));
+
+  report(container, keyName, "erase", size, load, time_ns_per_op(options, size, [&]() {
+      Set copy(set);
+      for (auto const& k : keys.hits)
+        copy.erase(k);
+      g_sink = g_sink + copy.size();
+    }));
+}
+
+// Batched lookups and parallel building, only available on the flat
+// containers.
+template <typename Set>
+void bench_batch(Options const& options, char const* container, char const* keyName, KeySets<typename Set::key_type> const& keys) {
+  size_t size = keys.hits.size();
+  double load = flat_load(size);
+
+  Set set(keys.hits.begin(), keys.hits.end());
+
+  report(container, keyName, "count_many_hit", size, load, time_ns_per_op(options, size, [&]() {
+      g_sink = g_sink + set.count_many(keys.hits.begin(), keys.hits.end());
+    }));
+
+  report(container, keyName, "count_many_miss", size, load, time_ns_per_op(options, size, [&]() {
+      g_sink = g_sink + set.count_many(keys.misses.begin(), keys.misses.end());
+    }));
+
+  report(container, keyName, "insert_parallel", size, load, time_ns_per_op(options, size, [&]() {
+      Set built;
+      flat_hash::parallel_insert(built, keys.hits.begin(), keys.hits.end());
+      g_sink = g_sink + built.size();
+    }));
+}
+
+// frozen_hash_map is only built from a range and then read.
+template <typename Map>
+void bench_frozen(Options const& options, char const* container, char const* keyName, KeySets<typename Map::key_type> const& keys) {
+  typedef std::pair<typename Map::key_type, size_t> Value;
+  size_t size = keys.hits.size();
+  double load = 1.0;
+
+  std::vector<Value> values;
+  for (size_t i = 0; i < size; ++i)
+    values.push_back(Value(keys.hits[i], i));
+
+  report(container, keyName, "build", size, load, time_ns_per_op(options, size, [&]() {
+      Map map(values.begin(), values.end());
+      g_sink = g_sink + map.size();
+    }));
+
+  Map map(values.begin(), values.end());
+
+  report(container, keyName, "find_hit", size, load, time_ns_per_op(options, size, [&]() {
+      size_t sum = 0;
+      for (auto const& k : keys.hits) {
+        auto i = map.find(k);
+        if (i != map.end())
+          sum += i->second;
+      }
+      g_sink = g_sink + sum;
+    }));
+
+  report(container, keyName, "find_miss", size, load, time_ns_per_op(options, size, [&]() {
+      size_t found = 0;
+      for (auto const& k : keys.misses)
+        found += map.find(k) != map.end();
+      g_sink = g_sink + found;
+    }));
+}
+
+// Erases the values pred matches, with erase_if where Map has it, otherwise
+// with the erase loop it replaces, or by key for maps that cannot erase by
+// iterator.
+template <typename Map, typename Predicate>
+auto erase_matching(Map& map, Predicate const& pred, int) -> decltype(map.retain(pred)) {
+  return erase_if(map, pred);
+}
+
+template <typename Map, typename Predicate>
+auto erase_matching(Map& map, Predicate const& pred, long) -> decltype(map.erase(map.begin()), size_t()) {
+  size_t erased = 0;
+  for (auto i = map.begin(); i != map.end();) {
+    if (pred(*i)) {
+      i = map.erase(i);
+      ++erased;
+    } else {
+      ++i;
+    }
+  }
+  return erased;
+}
+
+template <typename Map, typename Predicate>
+size_t erase_matching(Map& map, Predicate const& pred, ...) {
+  std::vector<typename Map::key_type> keys;
+  for (auto const& value : map) {
+    if (pred(value))
+      keys.push_back(value.first);
+  }
+  for (auto const& key : keys)
+    map.erase(key);
+  return keys.size();
+}
+
+template <typename Map>
+void bench_map(Options const& options, char const* container, char const* keyName, KeySets<typename Map::key_type> const& keys) {
+  typedef typename Map::value_type Value;
+  size_t size = keys.hits.size();
+  double load = flat_load(size);
+
+  report(container, keyName, "insert", size, load, time_ns_per_op(options, size, [&]() {
+      Map map;
+      for (size_t i = 0; i < size; ++i)
+        map.insert(Value(keys.hits[i], i));
+      g_sink = g_sink + map.size();
+    }));
+
+  report(container, keyName, "insert_reserved", size, load, time_ns_per_op(options, size, [&]() {
+      Map map;
+      map.reserve(size);
+      for (size_t i = 0; i < size; ++i)
+        map.insert(Value(keys.hits[i], i));
+      g_sink = g_sink + map.size();
+    }));
+
+  // The slowest single insert while filling the map, which shows the pause
+  // caused by the biggest growth rather than its amortized cost.
+  double worst = 0.0;
+  for (size_t r = 0; r < options.repeat; ++r) {
+    Map map;
+    double runWorst = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      map.insert(Value(keys.hits[i], i));
+      auto end = std::chrono::steady_clock::now();
+      runWorst = std::max(runWorst, std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    g_sink = g_sink + map.size();
+    if (r == 0 || runWorst < worst)
+      worst = runWorst;
+  }
+  report(container, keyName, "insert_worst", size, load, worst);
+
+  report(container, keyName, "operator[]", size, load, time_ns_per_op(options, size * 2, [&]() {
+      Map map;
+      for (auto const& k : keys.hits)
+        ++map[k];
+      for (auto const& k : keys.hits)
+        ++map[k];
+      g_sink = g_sink + map.size();
+    }));
+
+  Map map;
+  for (size_t i = 0; i < size; ++i)
+    map.insert(Value(keys.hits[i], i));
+
+  report(container, keyName, "find_hit", size, load, time_ns_per_op(options, size, [&]() {
+      size_t sum = 0;
+      for (auto const& k : keys.hits) {
+        auto i = map.find(k);
+        if (i != map.end())
+          sum += i->second;
+      }
+      g_sink = g_sink + sum;
+    }));
+
+  report(container, keyName, "find_miss", size, load, time_ns_per_op(options, size, [&]() {
+      size_t found = 0;
+      for (auto const& k : keys.misses)
+        found += map.find(k) != map.end();
+      g_sink = g_sink + found;
+    }));
+
+  report(container, keyName, "iterate", size, load, time_ns_per_op(options, size, [&]() {
+      size_t sum = 0;
+      for (auto const& p : map)
+        sum += p.second;
+      g_sink = g_sink + sum;
+    }));
+
+  report(container, keyName, "rehash", size, load, time_ns_per_op(options, size, [&]() {
+      Map copy(map);
+      copy.reserve(size * 2);
+      g_sink = g_sink + copy.size();
+    }));
+
+  report(container, keyName, "erase", size, load, time_ns_per_op(options, size, [&]() {
+      Map copy(map);
+      for (auto const& k : keys.hits)
+        copy.erase(k);
+      g_sink = g_sink + copy.size();
+    }));
+
+  // Prunes 40% of the values, as an expiry sweep would, one by one and then
+  // with erase_if.  Both include copying the map.
+  auto pruned = [](Value const& value) { return value.second % 5 < 2; };
+  report(container, keyName, "erase_loop_40", size, load, time_ns_per_op(options, size, [&]() {
+      Map copy(map);
+      g_sink = g_sink + erase_matching(copy, pruned, 0L);
+    }));
+
+  report(container, keyName, "erase_if_40", size, load, time_ns_per_op(options, size, [&]() {
+      Map copy(map);
+      g_sink = g_sink + erase_matching(copy, pruned, 0);
+    }));
+
+  // Iterates over what is left after erasing 95% of the values, as a table is
+  // after a burst, so most of the time goes on skipping empty buckets.  Per
+  // value left.
+  Map sparse(map);
+  erase_matching(sparse, [](Value const& value) { return value.second % 20 != 0; }, 0);
+  report(container, keyName, "iterate_sparse", size, load, time_ns_per_op(options, sparse.size(), [&]() {
+      size_t sum = 0;
+      for (auto const& p : sparse)
+        sum += p.second;
+      g_sink = g_sink + sum;
+    }));
+
+  // Reuses a table sized for every key as a scratch map, filling in a few
+  // values and clearing it again, so the time is mostly that of clear.  Per
+  // clear.
+  size_t const ScratchRounds = 1000;
+  Map scratch;
+  scratch.reserve(size);
+  report(container, keyName, "clear_scratch", size, load, time_ns_per_op(options, ScratchRounds, [&]() {
+      for (size_t r = 0; r < ScratchRounds; ++r) {
+        for (size_t i = 0; i < 4; ++i)
+          scratch.insert(Value(keys.hits[(r * 4 + i) % size], i));
+        g_sink = g_sink + scratch.size();
+        scratch.clear();
+      }
+    }));
+}
+
+bool selected(Options const& options, char const* container, char const* keyName) {
+  if (options.filter.empty())
+    return true;
+  std::string name = std::string(container) + "," + keyName;
+  return name.find(options.filter) != std::string::npos;
+}
+
+template <typename Key>
+void bench_key(Options const& options) {
+  char const* keyName = KeyGen<Key>::name();
+
+  // Sweep sizes that land both just under MaxFillLevel (0.69 of a power of
+  // two bucket count) and at a moderate load (0.4) right after a doubling.
+  for (size_t buckets = 16; buckets * 0.4 <= options.maxSize; buckets *= 2) {
+    for (double fill : {0.4, 0.69}) {
+      size_t size = (size_t)(buckets * fill);
+      if (size < options.minSize || size > options.maxSize)
+        continue;
+
+      KeySets<Key> keys(size, options.seed);
+
+      if (selected(options, "flat_hash::hash_set", keyName)) {
+        bench_set<flat_hash::hash_set<Key>>(options, "flat_hash::hash_set", keyName, keys);
+        bench_batch<flat_hash::hash_set<Key>>(options, "flat_hash::hash_set", keyName, keys);
+      }
+      if (selected(options, "std::unordered_set", keyName))
+        bench_set<std::unordered_set<Key>>(options, "std::unordered_set", keyName, keys);
+      if (selected(options, "flat_hash::hash_map", keyName))
+        bench_map<flat_hash::hash_map<Key, size_t>>(options, "flat_hash::hash_map", keyName, keys);
+      if (selected(options, "flat_hash::hash_set/control", keyName)) {
+        bench_set<flat_hash::hash_set<Key, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::control_layout>>(
+            options, "flat_hash::hash_set/control", keyName, keys);
+        bench_batch<flat_hash::hash_set<Key, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::control_layout>>(
+            options, "flat_hash::hash_set/control", keyName, keys);
+      }
+      if (selected(options, "flat_hash::hash_map/control", keyName))
+        bench_map<flat_hash::hash_map<Key, size_t, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::control_layout>>(
+            options, "flat_hash::hash_map/control", keyName, keys);
+      if (selected(options, "flat_hash::hash_set/compact", keyName)) {
+        bench_set<flat_hash::hash_set<Key, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::compact_layout>>(
+            options, "flat_hash::hash_set/compact", keyName, keys);
+        bench_batch<flat_hash::hash_set<Key, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::compact_layout>>(
+            options, "flat_hash::hash_set/compact", keyName, keys);
+      }
+      if (selected(options, "flat_hash::hash_map/compact", keyName))
+        bench_map<flat_hash::hash_map<Key, size_t, std::hash<Key>, std::equal_to<Key>, std::allocator<Key>, flat_hash::compact_layout>>(
+            options, "flat_hash::hash_map/compact", keyName, keys);
+      // Only differs from hash_map once the bucket array reaches 2 MB, from
+      // there on most finds miss the TLB with 4 KB pages.
+      if (selected(options, "flat_hash::hash_map/huge_pages", keyName))
+        bench_map<flat_hash::hash_map<Key, size_t, std::hash<Key>, std::equal_to<Key>, flat_hash::huge_page_allocator<Key>>>(
+            options, "flat_hash::hash_map/huge_pages", keyName, keys);
+      if (selected(options, "flat_hash::frozen_hash_map", keyName))
+        bench_frozen<flat_hash::frozen_hash_map<Key, size_t>>(options, "flat_hash::frozen_hash_map", keyName, keys);
+      if (selected(options, "flat_hash::incremental_hash_map", keyName))
+        bench_map<flat_hash::incremental_hash_map<Key, size_t>>(options, "flat_hash::incremental_hash_map", keyName, keys);
+      if (selected(options, "std::unordered_map", keyName))
+        bench_map<std::unordered_map<Key, size_t>>(options, "std::unordered_map", keyName, keys);
+    }
+  }
+}
+
+// A hash_map behind a single mutex, what concurrent_hash_map replaces.
+template <typename Key>
+struct LockedMap {
+  bool find(Key const& key, size_t& result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto i = map.find(key);
+    if (i == map.end())
+      return false;
+    result = i->second;
+    return true;
+  }
+
+  void insert_or_assign(Key const& key, size_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    map.insert_or_assign(key, value);
+  }
+
+  std::mutex mutex;
+  flat_hash::hash_map<Key, size_t> map;
+};
+
+// Every thread runs 90% finds and 10% insert_or_assign over the whole key
+// set, the time reported is wall clock time divided by the total number of
+// operations of all threads, so it drops as throughput scales.
+template <typename Map, typename Key>
+void bench_threads(Options const& options, char const* container, char const* keyName, KeySets<Key> const& keys) {
+  size_t size = keys.hits.size();
+  size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  for (size_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2) {
+    Map map;
+    for (size_t i = 0; i < size; ++i)
+      map.insert_or_assign(keys.hits[i], i);
+
+    char op[64];
+    std::snprintf(op, sizeof(op), "mixed_90_10_%zut", threadCount);
+    report(container, keyName, op, size, flat_load(size), time_ns_per_op(options, size * threadCount, [&]() {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threadCount; ++t) {
+          threads.emplace_back([&, t]() {
+              size_t sum = 0;
+              for (size_t n = 0; n < size; ++n) {
+                size_t i = (n * 7919 + t * 104729) % size;
+                if (n % 10 == 0) {
+                  map.insert_or_assign(keys.hits[i], n);
+                } else {
+                  size_t value;
+                  if (map.find(keys.hits[i], value))
+                    sum += value;
+                }
+              }
+              g_sink = g_sink + sum;
+            });
+        }
+        for (auto& thread : threads)
+          thread.join();
+      }));
+  }
+}
+
+// read_mostly_hash_map only takes trivially copyable keys.
+template <typename Key>
+void bench_read_mostly(Options const&, char const*, KeySets<Key> const&, std::false_type) {
+}
+
+template <typename Key>
+void bench_read_mostly(Options const& options, char const* keyName, KeySets<Key> const& keys, std::true_type) {
+  if (selected(options, "flat_hash::read_mostly_hash_map", keyName))
+    bench_threads<flat_hash::read_mostly_hash_map<Key, size_t>>(options, "flat_hash::read_mostly_hash_map", keyName, keys);
+}
+
+template <typename Key>
+void bench_concurrent(Options const& options) {
+  char const* keyName = KeyGen<Key>::name();
+  size_t size = std::max(std::min<size_t>(options.maxSize, 1 << 20), options.minSize);
+  KeySets<Key> keys(size, options.seed);
+
+  if (selected(options, "flat_hash::concurrent_hash_map", keyName))
+    bench_threads<flat_hash::concurrent_hash_map<Key, size_t>>(options, "flat_hash::concurrent_hash_map", keyName, keys);
+  if (selected(options, "flat_hash::hash_map+mutex", keyName))
+    bench_threads<LockedMap<Key>>(options, "flat_hash::hash_map+mutex", keyName, keys);
+  bench_read_mostly(options, keyName, keys, std::is_trivially_copyable<Key>());
+}
+
+void usage(char const* program) {
+  std::fprintf(stderr,
+      "usage: %s [--min-size N] [--max-size N] [--repeat N] [--seed N] [--filter STRING]\n"
+      "\n"
+      "  --min-size N    smallest element count to benchmark (default 256)\n"
+      "  --max-size N    largest element count to benchmark (default 4194304), sizes\n"
+      "                  of several hundred million reach tables of several GB\n"
+      "  --repeat N      runs per measurement, the fastest is reported (default 3)\n"
+      "  --seed N        seed for key generation (default 0)\n"
+      "  --filter S      only run container / key combinations whose\n"
+      "                  \"container,key\" name contains S, eg \"string\" or\n"
+      "                  \"flat_hash::hash_map,int\"\n",
+      program);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    char const* value = argv[++i];
+    if (arg == "--min-size") {
+      options.minSize = std::strtoull(value, nullptr, 10);
+    } else if (arg == "--max-size") {
+      options.maxSize = std::strtoull(value, nullptr, 10);
+    } else if (arg == "--repeat") {
+      options.repeat = std::strtoull(value, nullptr, 10);
+    } else if (arg == "--seed") {
+      options.seed = std::strtoull(value, nullptr, 10);
+    } else if (arg == "--filter") {
+      options.filter = value;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.repeat == 0)
+    options.repeat = 1;
+
+  std::printf("container,key,op,size,buckets_load,ns_per_op\n");
+  bench_key<int>(options);
+  bench_key<uint64_t>(options);
+  bench_key<std::string>(options);
+  bench_key<Blob64>(options);
+  bench_concurrent<int>(options);
+  bench_concurrent<std::string>(options);
+
+  return 0;
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
+#include <vector>
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// A hash map that is safe to use from many threads at once.  Keys are split by
+// hash over a number of independent hash_table shards, each guarded by its own
+// reader-writer lock, so operations on different shards never wait for each
+// other and lookups in the same shard only wait for writers.
+//
+// Since another thread may move any value at any time, this has no iterators.
+// Values are only reachable through the function passed to visit or for_each,
+// which runs with the shard locked, or by copying them out with find.  Those
+// functions must not call back into the same map.
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>, typename Layout = inline_hash_layout>
+class concurrent_hash_map {
+public:
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<key_type const, mapped_type> value_type;
+  typedef size_t size_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+  typedef Allocator allocator_type;
+
+  static constexpr size_t DefaultShardCount = 64;
+
+  // shardCount is rounded up to a power of two.  Use at least a few times as
+  // many shards as there are threads, so that they rarely contend.
+  explicit concurrent_hash_map(size_t shardCount = DefaultShardCount, hasher const& hash = hasher(),
+      key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
+
+  concurrent_hash_map(concurrent_hash_map const&) = delete;
+  concurrent_hash_map& operator=(concurrent_hash_map const&) = delete;
+
+  // These lock each shard in turn, so with concurrent writers the result need
+  // not match the contents of the map at any single point in time.
+  size_t empty() const;
+  size_t size() const;
+  void clear();
+
+  // Returns whether the value was inserted, false if the key was present.
+  bool insert(value_type const& value);
+  template <typename... Args>
+  bool try_emplace(key_type const& key, Args&&... args);
+  template <typename... Args>
+  bool try_emplace(key_type&& key, Args&&... args);
+  // Returns true if inserted, false if assigned.
+  template <typename M>
+  bool insert_or_assign(key_type const& key, M&& obj);
+
+  size_t erase(key_type const& key);
+  // Erases every value for which pred(value) returns true, locking one shard
+  // at a time and sweeping it in one pass, see hash_map::retain.  Returns the
+  // number erased.
+  template <typename Predicate>
+  size_t erase_if(Predicate&& pred);
+
+  size_t count(key_type const& key) const;
+  // Copies the mapped value of key into result, returns false if not present.
+  bool find(key_type const& key, mapped_type& result) const;
+
+  // Calls function with the value of key, if present, with its shard locked
+  // exclusively for the non-const version and shared for the const version.
+  // Returns whether the key was found.
+  template <typename Function>
+  bool visit(key_type const& key, Function&& function);
+  template <typename Function>
+  bool visit(key_type const& key, Function&& function) const;
+
+  // Calls function with every value, locking one shard at a time.
+  template <typename Function>
+  void for_each(Function&& function);
+  template <typename Function>
+  void for_each(Function&& function) const;
+
+  // Reserves room for capacity values, spread evenly over the shards.
+  void reserve(size_t capacity);
+
+private:
+  typedef std::pair<key_type, mapped_type> TableValue;
+
+  struct GetKey {
+    key_type const& operator()(TableValue const& value) const;
+  };
+
+  typedef hash_table<TableValue, key_type, GetKey, Hash, Equals, typename std::allocator_traits<Allocator>::template rebind_alloc<TableValue>, Layout> Table;
+  typedef std::shared_timed_mutex Mutex;
+  typedef std::unique_lock<Mutex> WriteLock;
+  typedef std::shared_lock<Mutex> ReadLock;
+
+  // Each shard is allocated on its own and padded out, so that the locks of
+  // different shards, which different threads hammer on, never share a cache
+  // line.
+  struct Shard {
+    Shard(Table table);
+
+    mutable Mutex mutex;
+    Table table;
+    char padding[64];
+  };
+
+  // Picks the shard from the top bits of the hash, which hash_key has mixed
+  // unless the hasher is avalanching, the tables use the low bits.
+  Shard& shardFor(size_t hash);
+  Shard const& shardFor(size_t hash) const;
+
+  hasher m_hash;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  // The shard count is 2^m_shardBits.
+  size_t m_shardBits;
+};
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::DefaultShardCount;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::GetKey::operator()(TableValue const& value) const -> key_type const& {
+  return value.first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::Shard::Shard(Table table)
+  : table(std::move(table)) {}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::concurrent_hash_map(size_t shardCount,
+    hasher const& hash, key_equal const& equal, allocator_type const& alloc)
+  : m_hash(hash), m_shardBits(0) {
+  size_t count = 1;
+  while (count < shardCount) {
+    count *= 2;
+    ++m_shardBits;
+  }
+
+  m_shards.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    m_shards.emplace_back(new Shard(Table(0, GetKey(), hash, equal, alloc)));
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::empty() const {
+  for (auto const& shardPtr : m_shards) {
+    Shard const& shard = *shardPtr;
+    ReadLock lock(shard.mutex);
+    if (!shard.table.empty())
+      return false;
+  }
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::size() const {
+  size_t size = 0;
+  for (auto const& shardPtr : m_shards) {
+    Shard const& shard = *shardPtr;
+    ReadLock lock(shard.mutex);
+    size += shard.table.size();
+  }
+  return size;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::clear() {
+  for (auto& shardPtr : m_shards) {
+    Shard& shard = *shardPtr;
+    WriteLock lock(shard.mutex);
+    shard.table.clear();
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(value_type const& value) {
+  return try_emplace(value.first, value.second);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type const& key, Args&&... args) {
+  size_t hash = hash_key(m_hash, key);
+  Shard& shard = shardFor(hash);
+  WriteLock lock(shard.mutex);
+  return shard.table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)).second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type&& key, Args&&... args) {
+  size_t hash = hash_key(m_hash, key);
+  Shard& shard = shardFor(hash);
+  WriteLock lock(shard.mutex);
+  return shard.table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)).second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(key_type const& key, M&& obj) {
+  size_t hash = hash_key(m_hash, key);
+  Shard& shard = shardFor(hash);
+  WriteLock lock(shard.mutex);
+  auto res = shard.table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<M>(obj)));
+  if (!res.second)
+    res.first->second = std::forward<M>(obj);
+  return res.second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(key_type const& key) {
+  size_t hash = hash_key(m_hash, key);
+  Shard& shard = shardFor(hash);
+  WriteLock lock(shard.mutex);
+  auto i = shard.table.findHashed(key, hash);
+  if (i == shard.table.end())
+    return 0;
+  shard.table.erase(i);
+  return 1;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Predicate>
+size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase_if(Predicate&& pred) {
+  size_t erased = 0;
+  for (auto& shardPtr : m_shards) {
+    Shard& shard = *shardPtr;
+    WriteLock lock(shard.mutex);
+    erased += shard.table.eraseIf([&pred](TableValue& value) { return pred((value_type&)value); });
+  }
+  return erased;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count(key_type const& key) const {
+  return visit(key, [](value_type const&) {}) ? 1 : 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key, mapped_type& result) const {
+  return visit(key, [&result](value_type const& value) {
+      result = value.second;
+    });
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::visit(key_type const& key, Function&& function) {
+  size_t hash = hash_key(m_hash, key);
+  Shard& shard = shardFor(hash);
+  WriteLock lock(shard.mutex);
+  auto i = shard.table.findHashed(key, hash);
+  if (i == shard.table.end())
+    return false;
+  function((value_type&)*i);
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+bool concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::visit(key_type const& key, Function&& function) const {
+  size_t hash = hash_key(m_hash, key);
+  Shard const& shard = shardFor(hash);
+  ReadLock lock(shard.mutex);
+  auto i = shard.table.findHashed(key, hash);
+  if (i == shard.table.end())
+    return false;
+  function((value_type const&)*i);
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::for_each(Function&& function) {
+  for (auto& shardPtr : m_shards) {
+    Shard& shard = *shardPtr;
+    WriteLock lock(shard.mutex);
+    for (auto& value : shard.table)
+      function((value_type&)value);
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::for_each(Function&& function) const {
+  for (auto const& shardPtr : m_shards) {
+    Shard const& shard = *shardPtr;
+    ReadLock lock(shard.mutex);
+    for (auto const& value : shard.table)
+      function((value_type const&)value);
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::reserve(size_t capacity) {
+  size_t perShard = (capacity + m_shards.size() - 1) / m_shards.size();
+  for (auto& shardPtr : m_shards) {
+    Shard& shard = *shardPtr;
+    WriteLock lock(shard.mutex);
+    shard.table.reserve(perShard);
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::shardFor(size_t hash) -> Shard& {
+  // Shifting by the full width of size_t is undefined.
+  if (m_shardBits == 0)
+    return *m_shards[0];
+  return *m_shards[hash >> (sizeof(size_t) * 8 - m_shardBits)];
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto concurrent_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::shardFor(size_t hash) const -> Shard const& {
+  return const_cast<concurrent_hash_map*>(this)->shardFor(hash);
+}
+
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// The default hasher of constexpr_hash_map, as std::hash cannot be used in
+// constant expressions.  Integers and enums hash to themselves like they do
+// with std::hash, strings (char const* and, from C++17, std::string_view) with
+// FNV-1a.
+template <typename T, typename Enable = void>
+struct constexpr_hash;
+
+template <typename T>
+struct constexpr_hash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+  constexpr size_t operator()(T value) const;
+};
+
+template <>
+struct constexpr_hash<char const*> {
+  constexpr size_t operator()(char const* value) const;
+};
+
+// The default key_equal of constexpr_hash_map, which is std::equal_to except
+// that char const* keys compare as strings.
+template <typename T>
+struct constexpr_equal_to {
+  constexpr bool operator()(T const& lhs, T const& rhs) const;
+};
+
+template <>
+struct constexpr_equal_to<char const*> {
+  constexpr bool operator()(char const* lhs, char const* rhs) const;
+};
+
+#if __cplusplus >= 201703L
+template <>
+struct constexpr_hash<std::string_view> {
+  constexpr size_t operator()(std::string_view value) const;
+};
+#endif
+
+// A hash map of at most Count values built entirely at compile time, for fixed
+// keyword and opcode tables that would otherwise be filled during static
+// initialization.  A constexpr constructed map needs no initialization at run
+// time and can be looked up in constant expressions, so lookups of constant
+// keys fold away.
+//
+// Values are placed exactly as hash_table places them, robin hood linear
+// probing on hashes mixed by hash_key unless the hasher is avalanching, with
+// the table at most 70% full, but in fixed size arrays, with keys
+// and mapped values apart so that only assignments of the key and mapped types
+// themselves need to be constexpr.  Both must be literal types that are
+// default constructible.  The hasher and key_equal must be usable in constant
+// expressions, which std::hash is not, hence constexpr_hash.  Like hash_map,
+// the first of several equal keys wins, and size() may then be less than
+// Count.
+template <typename Key, typename Mapped, size_t Count, typename Hash = constexpr_hash<Key>, typename Equals = constexpr_equal_to<Key>>
+class constexpr_hash_map {
+public:
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<Key, Mapped> value_type;
+  typedef size_t size_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+
+  constexpr constexpr_hash_map(value_type const (&values)[Count], hasher const& hash = hasher(), key_equal const& equal = key_equal());
+
+  constexpr bool empty() const;
+  constexpr size_t size() const;
+  constexpr size_t bucket_count() const;
+
+  // Returns the mapped value of key, or null.
+  constexpr mapped_type const* find(key_type const& key) const;
+  constexpr size_t count(key_type const& key) const;
+  // Throws std::out_of_range if key is missing, which in a constant expression
+  // fails to compile.
+  constexpr mapped_type const& at(key_type const& key) const;
+
+  // Calls function(key, mapped) for every value, in bucket order.
+  template <typename Function>
+  constexpr void for_each(Function&& function) const;
+
+private:
+  static constexpr size_t MinCapacity = 8;
+  static constexpr size_t FilledHashBit = (size_t)1 << (sizeof(size_t) * 8 - 1);
+
+  // The smallest power of two bucket count, at least MinCapacity, that keeps
+  // Count values at most 70% full.
+  static constexpr size_t bucketCountFor(size_t count);
+
+  static constexpr size_t BucketCount = bucketCountFor(Count);
+
+  constexpr size_t hashBucket(size_t hash) const;
+  constexpr size_t bucketDistance(size_t bucket) const;
+  constexpr size_t findBucket(key_type const& key) const;
+  constexpr void insert(key_type const& key, mapped_type const& mapped);
+
+  hasher m_hash;
+  key_equal m_equals;
+  size_t m_size;
+  // Zero for an empty bucket, otherwise the hash_key of its key with
+  // FilledHashBit set.
+  size_t m_hashes[BucketCount];
+  key_type m_keys[BucketCount];
+  mapped_type m_mapped[BucketCount];
+};
+
+// Builds a constexpr_hash_map from a braced list of pairs, working out the
+// count, eg
+//   constexpr auto opcodes = make_constexpr_hash_map<char const*, int>({{"add", 1}, {"sub", 2}});
+template <typename Key, typename Mapped, typename Hash = constexpr_hash<Key>, typename Equals = constexpr_equal_to<Key>, size_t Count>
+constexpr constexpr_hash_map<Key, Mapped, Count, Hash, Equals> make_constexpr_hash_map(std::pair<Key, Mapped> const (&values)[Count],
+    Hash const& hash = Hash(), Equals const& equal = Equals());
+
+template <typename T>
+constexpr size_t constexpr_hash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>::operator()(T value) const {
+  return (size_t)value;
+}
+
+constexpr size_t constexpr_hash<char const*>::operator()(char const* value) const {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (; *value; ++value)
+    hash = (hash ^ (unsigned char)*value) * 0x100000001b3;
+  return (size_t)hash;
+}
+
+template <typename T>
+constexpr bool constexpr_equal_to<T>::operator()(T const& lhs, T const& rhs) const {
+  return lhs == rhs;
+}
+
+constexpr bool constexpr_equal_to<char const*>::operator()(char const* lhs, char const* rhs) const {
+  for (; *lhs && *lhs == *rhs; ++lhs, ++rhs) {}
+  return *lhs == *rhs;
+}
+
+#if __cplusplus >= 201703L
+constexpr size_t constexpr_hash<std::string_view>::operator()(std::string_view value) const {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : value)
+    hash = (hash ^ (unsigned char)c) * 0x100000001b3;
+  return (size_t)hash;
+}
+#endif
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::MinCapacity;
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::FilledHashBit;
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::BucketCount;
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::constexpr_hash_map(
+    value_type const (&values)[Count], hasher const& hash, key_equal const& equal)
+  : m_hash(hash), m_equals(equal), m_size(0), m_hashes(), m_keys(), m_mapped() {
+  for (size_t i = 0; i < Count; ++i)
+    insert(values[i].first, values[i].second);
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr bool constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::empty() const {
+  return m_size == 0;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::size() const {
+  return m_size;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::bucket_count() const {
+  return BucketCount;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr auto constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::find(key_type const& key) const -> mapped_type const* {
+  size_t bucket = findBucket(key);
+  if (bucket == BucketCount)
+    return nullptr;
+  return &m_mapped[bucket];
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::count(key_type const& key) const {
+  return findBucket(key) == BucketCount ? 0 : 1;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr auto constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::at(key_type const& key) const -> mapped_type const& {
+  size_t bucket = findBucket(key);
+  if (bucket == BucketCount)
+    throw std::out_of_range("no such key in constexpr_hash_map");
+  return m_mapped[bucket];
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+template <typename Function>
+constexpr void constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::for_each(Function&& function) const {
+  for (size_t i = 0; i < BucketCount; ++i) {
+    if (m_hashes[i] != 0)
+      function(m_keys[i], m_mapped[i]);
+  }
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::bucketCountFor(size_t count) {
+  size_t bucketCount = MinCapacity;
+  while (count * 10 > bucketCount * 7)
+    bucketCount *= 2;
+  return bucketCount;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::hashBucket(size_t hash) const {
+  return hash & (BucketCount - 1);
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::bucketDistance(size_t bucket) const {
+  return hashBucket(bucket - m_hashes[bucket]);
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr size_t constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::findBucket(key_type const& key) const {
+  size_t hash = hash_key(m_hash, key) | FilledHashBit;
+  size_t currentBucket = hashBucket(hash);
+  size_t distance = 0;
+  // As in hash_table, runs are ordered by target bucket, so the key is missing
+  // once a value closer to its target than the key would be turns up.
+  while (m_hashes[currentBucket] != 0 && bucketDistance(currentBucket) >= distance) {
+    if (m_hashes[currentBucket] == hash && m_equals(m_keys[currentBucket], key))
+      return currentBucket;
+    currentBucket = hashBucket(currentBucket + 1);
+    ++distance;
+  }
+  return BucketCount;
+}
+
+template <typename Key, typename Mapped, size_t Count, typename Hash, typename Equals>
+constexpr void constexpr_hash_map<Key, Mapped, Count, Hash, Equals>::insert(key_type const& key, mapped_type const& mapped) {
+  size_t hash = hash_key(m_hash, key) | FilledHashBit;
+  size_t currentBucket = hashBucket(hash);
+  size_t distance = 0;
+
+  // The same placement as hash_table::tryEmplaceHashed: the first bucket that
+  // is empty or holds a value closer to its target, shifting the rest of the
+  // run one bucket to the right.
+  while (m_hashes[currentBucket] != 0) {
+    size_t entryDistance = bucketDistance(currentBucket);
+    if (entryDistance < distance)
+      break;
+
+    if (entryDistance == distance && m_hashes[currentBucket] == hash && m_equals(m_keys[currentBucket], key))
+      return;
+
+    currentBucket = hashBucket(currentBucket + 1);
+    ++distance;
+  }
+
+  size_t emptyBucket = currentBucket;
+  while (m_hashes[emptyBucket] != 0)
+    emptyBucket = hashBucket(emptyBucket + 1);
+  for (; emptyBucket != currentBucket; emptyBucket = hashBucket(emptyBucket - 1)) {
+    size_t previous = hashBucket(emptyBucket - 1);
+    m_hashes[emptyBucket] = m_hashes[previous];
+    m_keys[emptyBucket] = m_keys[previous];
+    m_mapped[emptyBucket] = m_mapped[previous];
+  }
+
+  m_hashes[currentBucket] = hash;
+  m_keys[currentBucket] = key;
+  m_mapped[currentBucket] = mapped;
+  ++m_size;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, size_t Count>
+constexpr constexpr_hash_map<Key, Mapped, Count, Hash, Equals> make_constexpr_hash_map(std::pair<Key, Mapped> const (&values)[Count],
+    Hash const& hash, Equals const& equal) {
+  return constexpr_hash_map<Key, Mapped, Count, Hash, Equals>(values, hash, equal);
+}
+
+}
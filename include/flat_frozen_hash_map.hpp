@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "flat_hash_map.hpp"
+
+namespace flat_hash {
+
+// An immutable hash map, built once from a range with a perfect hash, for
+// tables that are only read after startup.  The values are packed in an array
+// with no empty slots, and find looks at exactly one of them.
+//
+// Building uses hash and displace: keys are split by hash into groups of about
+// three, and every group, largest first, is given the smallest displacement
+// that sends all of its keys to slots still free.  find then only has to mix
+// the key's hash with the displacement of its group.  The displacements cost
+// one uint32_t per group, under a byte and a half per value.  Keys whose full
+// hashes are equal cannot be told apart this way and are found through a small
+// hash_map of their own instead, which is empty unless the hasher collides.
+//
+// Build time is a few times that of inserting into a hash_map.  Like
+// hash_map, the first of several equal keys in the range wins.
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>>
+class frozen_hash_map {
+public:
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<key_type const, mapped_type> value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+  typedef Allocator allocator_type;
+  typedef value_type const& const_reference;
+  typedef value_type const* const_pointer;
+
+  // The values never move, so iterators are plain pointers into the packed
+  // array.
+  typedef value_type const* const_iterator;
+  typedef const_iterator iterator;
+
+  frozen_hash_map();
+  template <typename InputIt>
+  frozen_hash_map(InputIt first, InputIt last, hasher const& hash = hasher(),
+      key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
+  frozen_hash_map(std::initializer_list<value_type> init, hasher const& hash = hasher(),
+      key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
+
+  const_iterator begin() const;
+  const_iterator end() const;
+  const_iterator cbegin() const;
+  const_iterator cend() const;
+
+  bool empty() const;
+  size_t size() const;
+
+  mapped_type const& at(key_type const& key) const;
+  size_t count(key_type const& key) const;
+  const_iterator find(key_type const& key) const;
+  std::pair<const_iterator, const_iterator> equal_range(key_type const& key) const;
+
+  bool operator==(frozen_hash_map const& rhs) const;
+  bool operator!=(frozen_hash_map const& rhs) const;
+
+private:
+  typedef std::pair<key_type, mapped_type> TableValue;
+  typedef std::vector<TableValue, typename std::allocator_traits<Allocator>::template rebind_alloc<TableValue>> Values;
+  typedef std::vector<uint32_t, typename std::allocator_traits<Allocator>::template rebind_alloc<uint32_t>> Displacements;
+
+  static constexpr size_t GroupSize = 3;
+  // A group that finds no displacement after this many tries per slot goes to
+  // the overflow map, which only happens with colliding hashes.
+  static constexpr size_t MaxTriesPerSlot = 64;
+  // Set in the displacement of a group of one to give its slot directly, so
+  // that the last groups, which are all of one, need not search for the last
+  // few free slots.
+  static constexpr uint32_t DirectSlot = 0x80000000;
+
+  // Spreads the hash, as hash_table does not need hashes to be good and this
+  // does.  The group comes from the top half of the result and the slot from
+  // the bottom half.
+  static uint64_t mix(uint64_t hash);
+  // Maps the top 32 bits of x evenly onto [0, range).
+  static size_t reduce(uint64_t x, size_t range);
+
+  size_t groupOf(uint64_t mixed) const;
+  static size_t slotOf(uint64_t mixed, uint32_t displacement, size_t slotCount);
+
+  void build(Values&& entries);
+
+  hasher m_hash;
+  key_equal m_equals;
+  // One value per slot, then any overflow values left over once the empty
+  // slots are filled.  Overflow values are found by index through m_overflow.
+  Values m_values;
+  size_t m_slotCount;
+  Displacements m_displacements;
+  hash_map<Key, size_t, Hash, Equals, Allocator> m_overflow;
+};
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+constexpr size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::GroupSize;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+constexpr size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::MaxTriesPerSlot;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+constexpr uint32_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::DirectSlot;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::frozen_hash_map()
+  : frozen_hash_map((value_type const*)nullptr, (value_type const*)nullptr) {}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename InputIt>
+frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::frozen_hash_map(InputIt first, InputIt last,
+    hasher const& hash, key_equal const& equal, allocator_type const& alloc)
+  : m_hash(hash), m_equals(equal), m_values(alloc), m_slotCount(0), m_displacements(alloc), m_overflow(0, hash, equal, alloc) {
+  Values entries(alloc);
+  for (; first != last; ++first)
+    entries.emplace_back(*first);
+  build(std::move(entries));
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::frozen_hash_map(std::initializer_list<value_type> init,
+    hasher const& hash, key_equal const& equal, allocator_type const& alloc)
+  : frozen_hash_map(init.begin(), init.end(), hash, equal, alloc) {}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::begin() const -> const_iterator {
+  return (value_type const*)m_values.data();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::end() const -> const_iterator {
+  return (value_type const*)(m_values.data() + m_values.size());
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::cbegin() const -> const_iterator {
+  return begin();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::cend() const -> const_iterator {
+  return end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+bool frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::empty() const {
+  return m_values.empty();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::size() const {
+  return m_values.size();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::at(key_type const& key) const -> mapped_type const& {
+  auto i = find(key);
+  if (i == end())
+    throw std::out_of_range("no such key in frozen_hash_map");
+  return i->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::count(key_type const& key) const {
+  return find(key) != end() ? 1 : 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::find(key_type const& key) const -> const_iterator {
+  if (m_slotCount == 0)
+    return end();
+
+  uint64_t mixed = mix(m_hash(key));
+  size_t slot = slotOf(mixed, m_displacements[groupOf(mixed)], m_slotCount);
+  if (m_equals(m_values[slot].first, key))
+    return begin() + slot;
+
+  if (!m_overflow.empty()) {
+    auto i = m_overflow.find(key);
+    if (i != m_overflow.end())
+      return begin() + i->second;
+  }
+  return end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+auto frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::equal_range(key_type const& key) const -> std::pair<const_iterator, const_iterator> {
+  auto i = find(key);
+  if (i == end())
+    return {i, i};
+  return {i, i + 1};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+bool frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::operator==(frozen_hash_map const& rhs) const {
+  if (size() != rhs.size())
+    return false;
+
+  for (auto const& value : *this) {
+    auto j = rhs.find(value.first);
+    if (j == rhs.end() || !(*j == value))
+      return false;
+  }
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+bool frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::operator!=(frozen_hash_map const& rhs) const {
+  return !operator==(rhs);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+uint64_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::mix(uint64_t hash) {
+  // The splitmix64 finalizer.
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+  return hash ^ (hash >> 31);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::reduce(uint64_t x, size_t range) {
+  return (size_t)(((x >> 32) * range) >> 32);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::groupOf(uint64_t mixed) const {
+  return reduce(mixed, m_displacements.size());
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+size_t frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::slotOf(uint64_t mixed, uint32_t displacement, size_t slotCount) {
+  if (displacement & DirectSlot)
+    return displacement & ~DirectSlot;
+  return reduce((mixed << 32) ^ ((uint64_t)displacement + 1) * 0x9e3779b97f4a7c15, slotCount);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+void frozen_hash_map<Key, Mapped, Hash, Equals, Allocator>::build(Values&& entries) {
+  if (entries.size() >= DirectSlot)
+    throw std::length_error("frozen_hash_map holds fewer than 2^31 values");
+  if (entries.empty())
+    return;
+
+  // mix is a bijection, so keys have equal mixed hashes exactly when they have
+  // equal hashes.
+  std::vector<uint64_t> mixed(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i)
+    mixed[i] = mix(m_hash(entries[i].first));
+
+  size_t groupCount = (entries.size() + GroupSize - 1) / GroupSize;
+  m_displacements.assign(groupCount, 0);
+
+  // Sort the entries by group, keeping their order within each.
+  std::vector<size_t> groupStart(groupCount + 1);
+  for (size_t i = 0; i < entries.size(); ++i)
+    ++groupStart[groupOf(mixed[i]) + 1];
+  for (size_t g = 1; g <= groupCount; ++g)
+    groupStart[g] += groupStart[g - 1];
+  std::vector<size_t> byGroup(entries.size());
+  std::vector<size_t> groupEnd(groupStart.begin(), groupStart.end() - 1);
+  for (size_t i = 0; i < entries.size(); ++i)
+    byGroup[groupEnd[groupOf(mixed[i])]++] = i;
+
+  // Drop repeated keys, and set aside keys whose hash another key in the group
+  // already has, leaving the rest at the front of the group.  Groups are small,
+  // so comparing every pair is fine.
+  std::vector<size_t> overflow;
+  size_t placedCount = 0;
+  for (size_t g = 0; g < groupCount; ++g) {
+    size_t kept = groupStart[g];
+    size_t groupOverflow = overflow.size();
+    for (size_t n = groupStart[g]; n < groupEnd[g]; ++n) {
+      size_t i = byGroup[n];
+      bool repeated = false;
+      bool collides = false;
+      for (size_t k = groupStart[g]; k < kept; ++k) {
+        size_t j = byGroup[k];
+        if (mixed[j] == mixed[i]) {
+          collides = true;
+          repeated = repeated || m_equals(entries[j].first, entries[i].first);
+        }
+      }
+      for (size_t k = groupOverflow; k < overflow.size() && !repeated; ++k) {
+        size_t j = overflow[k];
+        repeated = mixed[j] == mixed[i] && m_equals(entries[j].first, entries[i].first);
+      }
+      if (repeated)
+        continue;
+      if (collides)
+        overflow.push_back(i);
+      else
+        byGroup[kept++] = i;
+    }
+    groupEnd[g] = kept;
+    placedCount += kept - groupStart[g];
+  }
+  m_slotCount = placedCount;
+
+  // Largest groups first, while there is still plenty of room.
+  std::vector<size_t> order(groupCount);
+  for (size_t g = 0; g < groupCount; ++g)
+    order[g] = g;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return groupEnd[a] - groupStart[a] > groupEnd[b] - groupStart[b];
+    });
+
+  // Tries mostly hit taken slots once the table fills up, so check those in a
+  // bitmap that stays in cache rather than in slotEntry.
+  std::vector<size_t> slotEntry(m_slotCount, (size_t)-1);
+  std::vector<uint64_t> taken((m_slotCount + 63) / 64);
+  std::vector<size_t> slots;
+  uint64_t maxDisplacement = std::min<uint64_t>((uint64_t)m_slotCount * MaxTriesPerSlot, DirectSlot);
+  size_t freeSlot = 0;
+  for (size_t g : order) {
+    size_t* group = byGroup.data() + groupStart[g];
+    size_t groupSize = groupEnd[g] - groupStart[g];
+    if (groupSize == 0)
+      break;
+
+    if (groupSize == 1) {
+      while (taken[freeSlot / 64] >> (freeSlot % 64) & 1)
+        ++freeSlot;
+      m_displacements[g] = DirectSlot | (uint32_t)freeSlot;
+      slotEntry[freeSlot] = group[0];
+      taken[freeSlot / 64] |= (uint64_t)1 << (freeSlot % 64);
+      continue;
+    }
+
+    bool placed = false;
+    for (uint64_t displacement = 0; displacement < maxDisplacement && !placed; ++displacement) {
+      slots.clear();
+      placed = true;
+      for (size_t k = 0; k < groupSize; ++k) {
+        size_t slot = slotOf(mixed[group[k]], (uint32_t)displacement, m_slotCount);
+        if ((taken[slot / 64] >> (slot % 64) & 1) || std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+          placed = false;
+          break;
+        }
+        slots.push_back(slot);
+      }
+      if (placed) {
+        m_displacements[g] = (uint32_t)displacement;
+        for (size_t k = 0; k < groupSize; ++k) {
+          slotEntry[slots[k]] = group[k];
+          taken[slots[k] / 64] |= (uint64_t)1 << (slots[k] % 64);
+        }
+      }
+    }
+
+    if (!placed)
+      overflow.insert(overflow.end(), group, group + groupSize);
+  }
+
+  // The slots of groups sent to the overflow are left empty, and there are
+  // always at least as many overflow values to fill them with, found through
+  // m_overflow like the rest.
+  m_values.reserve(placedCount + overflow.size());
+  size_t nextOverflow = 0;
+  for (size_t slot = 0; slot < m_slotCount; ++slot) {
+    size_t i = slotEntry[slot];
+    if (i == (size_t)-1) {
+      i = overflow[nextOverflow++];
+      m_overflow.insert({entries[i].first, slot});
+    }
+    m_values.push_back(std::move(entries[i]));
+  }
+  for (; nextOverflow < overflow.size(); ++nextOverflow) {
+    size_t i = overflow[nextOverflow];
+    m_overflow.insert({entries[i].first, m_values.size()});
+    m_values.push_back(std::move(entries[i]));
+  }
+}
+
+}
@@ -1,13 +1,18 @@
 #pragma once
 
+#include <cstddef>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
 
 #include "flat_hash_table.hpp"
 
 namespace flat_hash {
 
-template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>>
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>, typename Layout = inline_hash_layout>
 class hash_map {
 public:
   typedef Key key_type;
@@ -30,7 +35,7 @@ private:
     key_type const& operator()(TableValue const& value) const;
   };
 
-  typedef hash_table<TableValue, key_type, GetKey, Hash, Equals, typename Allocator::template rebind<TableValue>::other> Table;
+  typedef hash_table<TableValue, key_type, GetKey, Hash, Equals, typename std::allocator_traits<Allocator>::template rebind_alloc<TableValue>, Layout> Table;
 
 public:
   struct const_iterator {
@@ -73,6 +78,18 @@ public:
     typename Table::iterator inner;
   };
 
+private:
+  // Result, for the overloads that take any key type K, enabled only when Hash
+  // and Equals are transparent.  Iterators are excluded so that erase(iterator)
+  // still picks the iterator overload.
+  template <typename K, typename Result>
+  using EnableTransparent = typename std::enable_if<is_transparent_lookup<Hash, Equals, K>::value
+    && !std::is_convertible<K, const_iterator>::value, Result>::type;
+
+public:
+  typedef hash_node<TableValue> node_type;
+  typedef hash_insert_return<iterator, node_type> insert_return_type;
+
   hash_map();
   explicit hash_map(size_t bucketCount, hasher const& hash = hasher(),
       key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
@@ -106,6 +123,8 @@ public:
   hash_map& operator=(hash_map&& other);
   hash_map& operator=(std::initializer_list<value_type> init);
 
+  allocator_type get_allocator() const;
+
   iterator begin();
   iterator end();
 
@@ -128,18 +147,69 @@ public:
   template <typename InputIt>
   void insert(InputIt first, InputIt last);
   void insert(std::initializer_list<value_type> init);
+  // Like insert(first, last), but split into up to taskCount tasks that run may
+  // run in parallel, see hash_table::bulkInsert and parallel_insert in
+  // flat_parallel_build.hpp.  Only parallel when the container is empty.
+  template <typename RandomIt, typename RunTasks>
+  void insert_parallel(RandomIt first, RandomIt last, size_t taskCount, RunTasks&& run);
 
   template <typename... Args>
   std::pair<iterator, bool> emplace(Args&&... args);
   template <typename... Args>
   iterator emplace_hint(const_iterator hint, Args&&... args);
 
+  // Unlike emplace, these probe once and construct the mapped value from args
+  // only if the key is absent, directly in the bucket it ends up in.
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type const& key, Args&&... args);
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args);
+  template <typename... Args>
+  iterator try_emplace(const_iterator hint, key_type const& key, Args&&... args);
+  template <typename... Args>
+  iterator try_emplace(const_iterator hint, key_type&& key, Args&&... args);
+
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(key_type const& key, M&& obj);
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& obj);
+  template <typename M>
+  iterator insert_or_assign(const_iterator hint, key_type const& key, M&& obj);
+  template <typename M>
+  iterator insert_or_assign(const_iterator hint, key_type&& key, M&& obj);
+
   iterator erase(const_iterator pos);
   iterator erase(const_iterator first, const_iterator last);
   size_t erase(key_type const& key);
+  template <typename K>
+  EnableTransparent<K, size_t> erase(K const& key);
+  // Erases every value for which pred(value) returns false, in one pass that
+  // moves each remaining value at most once.  Returns the number erased.  See
+  // also erase_if.
+  template <typename Predicate>
+  size_t retain(Predicate&& pred);
+
+  // Takes the value at pos, or with the given key, out of the map along with
+  // its hash, the node is empty if there is no such key.
+  node_type extract(const_iterator pos);
+  node_type extract(key_type const& key);
+  // Inserts the value of node unless its key is present, in which case the
+  // node is handed back in the result.  The key is not hashed again, see
+  // hash_table::transferredHash.
+  insert_return_type insert(node_type&& node);
+  iterator insert(const_iterator hint, node_type&& node);
+  // Moves every value of source whose key is not present over, in one sweep
+  // of source and without hashing the keys again.  Values whose keys are
+  // present stay in source.
+  void merge(hash_map& source);
+  void merge(hash_map&& source);
 
   mapped_type& at(key_type const& key);
   mapped_type const& at(key_type const& key) const;
+  template <typename K>
+  EnableTransparent<K, mapped_type&> at(K const& key);
+  template <typename K>
+  EnableTransparent<K, mapped_type const&> at(K const& key) const;
 
   mapped_type& operator[](key_type const& key);
   mapped_type& operator[](key_type&& key);
@@ -150,7 +220,69 @@ public:
   std::pair<iterator, iterator> equal_range(key_type const& key);
   std::pair<const_iterator, const_iterator> equal_range(key_type const& key) const;
 
+  // Lookups by any key type that Hash and Equals accept, without converting it
+  // to key_type first.  Only available when both declare is_transparent.
+  template <typename K>
+  EnableTransparent<K, size_t> count(K const& key) const;
+  template <typename K>
+  EnableTransparent<K, const_iterator> find(K const& key) const;
+  template <typename K>
+  EnableTransparent<K, iterator> find(K const& key);
+  template <typename K>
+  EnableTransparent<K, std::pair<iterator, iterator>> equal_range(K const& key);
+  template <typename K>
+  EnableTransparent<K, std::pair<const_iterator, const_iterator>> equal_range(K const& key) const;
+
+  // Looks up a batch of keys at once, writing one iterator per key (end() if
+  // missing) to out.  Faster than repeated find when the table is much larger
+  // than the cache, as the bucket loads for a batch of keys are prefetched
+  // together.
+  template <typename KeyIterator, typename OutputIterator>
+  OutputIterator find_many(KeyIterator first, KeyIterator last, OutputIterator out) const;
+  template <typename KeyIterator, typename OutputIterator>
+  OutputIterator find_many(KeyIterator first, KeyIterator last, OutputIterator out);
+  // Returns how many of the keys in [first, last) are present.
+  template <typename KeyIterator>
+  size_t count_many(KeyIterator first, KeyIterator last) const;
+
   void reserve(size_t capacity);
+  // Rebuilds the table with at least bucketCount buckets, as few as hold every
+  // value within max_load_factor, so may shrink it.
+  void rehash(size_t bucketCount);
+  // Gives back the buckets left over after erasing many values.  Same as
+  // rehash(0), so frees all of them if the table is empty.
+  void shrink_to_fit();
+
+  size_t bucket_count() const;
+  // rehash, reserve and growing throw std::length_error past this.
+  size_t max_bucket_count() const;
+  float load_factor() const;
+  // The fraction of buckets filled before the table grows, 0.7 by default and
+  // clamped to [0.1, 0.95].  Setting it grows the table if it is over.
+  float max_load_factor() const;
+  void max_load_factor(float loadFactor);
+
+  // Probe distances, load and memory use, for spotting bad hashers.  See
+  // hash_table_stats.
+  hash_table_stats stats() const;
+
+  // The limit on probe distance past which the table reseeds or grows, see
+  // hash_table::maxProbeDistance.
+  size_t max_probe_distance() const;
+  void max_probe_distance(size_t distance);
+  // Zero unless the table has been reseeded.  Used by write_mapped_hash_map.
+  size_t bucket_seed() const;
+
+  // Calls function(hash, value) for every bucket in order, with zero and null
+  // for empty buckets.  Used by write_mapped_hash_map and save.
+  template <typename Function>
+  void for_each_bucket(Function&& function) const;
+  // Adds a value of key and a mapped value constructed from args given the
+  // hash for_each_bucket gave key, without hashing it, and only comparing it
+  // with keys of the same hash.  Returns false, adding nothing, if key is
+  // present already.  Used by load.
+  template <typename... Args>
+  bool emplace_unique_hashed(size_t hash, key_type&& key, Args&&... args);
 
   bool operator==(hash_map const& rhs) const;
   bool operator!=(hash_map const& rhs) const;
@@ -159,289 +291,376 @@ private:
   Table m_table;
 };
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::GetKey::operator()(TableValue const& value) const -> key_type const& {
+// Erases every value for which pred(value) returns true, like C++20's
+// std::erase_if, but in one pass, see hash_map::retain.  Returns the number erased.
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout, typename Predicate>
+size_t erase_if(hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>& map, Predicate pred);
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::GetKey::operator()(TableValue const& value) const -> key_type const& {
   return value.first;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator==(const_iterator const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator==(const_iterator const& rhs) const {
   return inner == rhs.inner;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator!=(const_iterator const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator!=(const_iterator const& rhs) const {
   return inner != rhs.inner;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator++() -> const_iterator& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator++() -> const_iterator& {
   ++inner;
   return *this;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator++(int) -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator++(int) -> const_iterator {
   const_iterator copy(*this);
   ++*this;
   return copy;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator*() const -> value_type& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator*() const -> value_type& {
   return *operator->();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator::operator->() const -> value_type* {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator->() const -> value_type* {
   return (value_type*)(&*inner);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator==(iterator const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator==(iterator const& rhs) const {
   return inner == rhs.inner;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator!=(iterator const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator!=(iterator const& rhs) const {
   return inner != rhs.inner;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator++() -> iterator& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator++() -> iterator& {
   ++inner;
   return *this;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator++(int) -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator++(int) -> iterator {
   iterator copy(*this);
   operator++();
   return copy;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator*() const -> value_type& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator*() const -> value_type& {
   return *operator->();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator->() const -> value_type* {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator->() const -> value_type* {
   return (value_type*)(&*inner);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::iterator::operator typename hash_map<Key, Mapped, Hash, Equals, Allocator>::const_iterator() const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator typename hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator() const {
   return const_iterator{inner};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map()
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map()
   : hash_map(0) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(size_t bucketCount, hasher const& hash,
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(size_t bucketCount, hasher const& hash,
     key_equal const& equal, allocator_type const& alloc)
   : m_table(bucketCount, GetKey(), hash, equal, alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(size_t bucketCount, allocator_type const& alloc)
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(size_t bucketCount, allocator_type const& alloc)
   : hash_map(bucketCount, hasher(), key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(size_t bucketCount, hasher const& hash,
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(size_t bucketCount, hasher const& hash,
     allocator_type const& alloc)
   : hash_map(bucketCount, hash, key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(allocator_type const& alloc)
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(allocator_type const& alloc)
   : hash_map(0, hasher(), key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename InputIt>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(InputIt first, InputIt last, size_t bucketCount,
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(InputIt first, InputIt last, size_t bucketCount,
     hasher const& hash, key_equal const& equal, allocator_type const& alloc)
   : hash_map(bucketCount, hash, equal, alloc) {
   insert(first, last);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename InputIt>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(InputIt first, InputIt last, size_t bucketCount,
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(InputIt first, InputIt last, size_t bucketCount,
     allocator_type const& alloc)
   : hash_map(first, last, bucketCount, hasher(), key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename InputIt>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(InputIt first, InputIt last, size_t bucketCount,
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(InputIt first, InputIt last, size_t bucketCount,
     hasher const& hash, allocator_type const& alloc)
   : hash_map(first, last, bucketCount, hash, key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(hash_map const& other)
-  : hash_map(other, other.m_table.getAllocator()) {}
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(hash_map const& other)
+  : hash_map(other, std::allocator_traits<allocator_type>::select_on_container_copy_construction(other.get_allocator())) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(hash_map const& other, allocator_type const& alloc)
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(hash_map const& other, allocator_type const& alloc)
   : hash_map(alloc) {
   operator=(other);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(hash_map&& other)
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(hash_map&& other)
   : hash_map(move(other), other.m_table.getAllocator()) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(hash_map&& other, allocator_type const& alloc)
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(hash_map&& other, allocator_type const& alloc)
   : hash_map(alloc) {
   operator=(move(other));
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(std::initializer_list<value_type> init, size_t bucketCount, hasher const& hash,
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(std::initializer_list<value_type> init, size_t bucketCount, hasher const& hash,
     key_equal const& equal, allocator_type const& alloc)
   : hash_map(bucketCount, hash, equal, alloc) {
   operator=(init);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(std::initializer_list<value_type> init, size_t bucketCount,
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(std::initializer_list<value_type> init, size_t bucketCount,
     allocator_type const& alloc)
   : hash_map(init, bucketCount, hasher(), key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-hash_map<Key, Mapped, Hash, Equals, Allocator>::hash_map(std::initializer_list<value_type> init, size_t bucketCount, hasher const& hash,
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::hash_map(std::initializer_list<value_type> init, size_t bucketCount, hasher const& hash,
     allocator_type const& alloc)
   : hash_map(init, bucketCount, hash, key_equal(), alloc) {}
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::operator=(hash_map const& other) -> hash_map& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator=(hash_map const& other) -> hash_map& {
   m_table.clear();
+  m_table.setMaxLoadFactor(other.m_table.maxLoadFactor());
   m_table.reserve(other.size());
   for (auto const& p : other)
-    m_table.insert(p);
+    insert(p);
   return *this;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::operator=(hash_map&& other) -> hash_map& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator=(hash_map&& other) -> hash_map& {
   m_table = move(other.m_table);
   return *this;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::operator=(std::initializer_list<value_type> init) -> hash_map& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator=(std::initializer_list<value_type> init) -> hash_map& {
   clear();
   insert(init.begin(), init.end());
   return *this;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::begin() -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::get_allocator() const -> allocator_type {
+  return allocator_type(m_table.getAllocator());
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::begin() -> iterator {
   return iterator{m_table.begin()};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::end() -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::end() -> iterator {
   return iterator{m_table.end()};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::begin() const -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::begin() const -> const_iterator {
   return const_iterator{m_table.begin()};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::end() const -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::end() const -> const_iterator {
   return const_iterator{m_table.end()};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::cbegin() const -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::cbegin() const -> const_iterator {
   return begin();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::cend() const -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::cend() const -> const_iterator {
   return end();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-size_t hash_map<Key, Mapped, Hash, Equals, Allocator>::empty() const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::empty() const {
   return m_table.empty();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-size_t hash_map<Key, Mapped, Hash, Equals, Allocator>::size() const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::size() const {
   return m_table.size();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-void hash_map<Key, Mapped, Hash, Equals, Allocator>::clear() {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::clear() {
   m_table.clear();
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(value_type const& value) -> std::pair<iterator, bool> {
-  auto res = m_table.insert(TableValue(value));
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(value_type const& value) -> std::pair<iterator, bool> {
+  auto res = m_table.tryEmplace(value.first, value);
   return {iterator{res.first}, res.second};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename T, typename>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(T&& value) -> std::pair<iterator, bool> {
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(T&& value) -> std::pair<iterator, bool> {
   auto res = m_table.insert(TableValue(std::forward<T&&>(value)));
   return {iterator{res.first}, res.second};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(const_iterator hint, value_type const& value) -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(const_iterator hint, value_type const& value) -> iterator {
   return insert(hint, TableValue(value));
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename T, typename>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(const_iterator, T&& value) -> iterator {
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(const_iterator, T&& value) -> iterator {
   return insert(std::forward<T&&>(value)).first;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename InputIt>
-void hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(InputIt first, InputIt last) {
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(InputIt first, InputIt last) {
   m_table.reserve(m_table.size() + std::distance(first, last));
   for (auto i = first; i != last; ++i)
-    m_table.insert(*i);
+    insert(*i);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-void hash_map<Key, Mapped, Hash, Equals, Allocator>::insert(std::initializer_list<value_type> init) {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(std::initializer_list<value_type> init) {
   insert(init.begin(), init.end());
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename RandomIt, typename RunTasks>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_parallel(RandomIt first, RandomIt last, size_t taskCount, RunTasks&& run) {
+  m_table.bulkInsert(first, last, [](auto const& value) -> auto const& { return value.first; }, taskCount, std::forward<RunTasks>(run));
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename... Args>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::emplace(Args&&... args) -> std::pair<iterator, bool> {
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::emplace(Args&&... args) -> std::pair<iterator, bool> {
   return insert(TableValue(std::forward<Args>(args)...));
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
 template <typename... Args>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::emplace_hint(const_iterator hint, Args&&... args) -> iterator {
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::emplace_hint(const_iterator hint, Args&&... args) -> iterator {
   return insert(hint, TableValue(std::forward<Args>(args)...));
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::erase(const_iterator pos) -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type const& key, Args&&... args) -> std::pair<iterator, bool> {
+  auto res = m_table.tryEmplace(key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+  return {iterator{res.first}, res.second};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type&& key, Args&&... args) -> std::pair<iterator, bool> {
+  // key is only moved from once the table has decided to construct the value.
+  auto res = m_table.tryEmplace(key, std::piecewise_construct,
+      std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+  return {iterator{res.first}, res.second};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(const_iterator, key_type const& key, Args&&... args) -> iterator {
+  return try_emplace(key, std::forward<Args>(args)...).first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(const_iterator, key_type&& key, Args&&... args) -> iterator {
+  return try_emplace(std::move(key), std::forward<Args>(args)...).first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(key_type const& key, M&& obj) -> std::pair<iterator, bool> {
+  auto res = try_emplace(key, std::forward<M>(obj));
+  if (!res.second)
+    res.first->second = std::forward<M>(obj);
+  return res;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(key_type&& key, M&& obj) -> std::pair<iterator, bool> {
+  auto res = try_emplace(std::move(key), std::forward<M>(obj));
+  if (!res.second)
+    res.first->second = std::forward<M>(obj);
+  return res;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(const_iterator, key_type const& key, M&& obj) -> iterator {
+  return insert_or_assign(key, std::forward<M>(obj)).first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(const_iterator, key_type&& key, M&& obj) -> iterator {
+  return insert_or_assign(std::move(key), std::forward<M>(obj)).first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(const_iterator pos) -> iterator {
   return iterator{m_table.erase(pos.inner)};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::erase(const_iterator first, const_iterator last) -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(const_iterator first, const_iterator last) -> iterator {
   return iterator{m_table.erase(first.inner, last.inner)};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-size_t hash_map<Key, Mapped, Hash, Equals, Allocator>::erase(key_type const& key) {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(key_type const& key) {
+  auto i = m_table.find(key);
+  if (i != m_table.end()) {
+    m_table.erase(i);
+    return 1;
+  }
+  return 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(K const& key) -> EnableTransparent<K, size_t> {
   auto i = m_table.find(key);
   if (i != m_table.end()) {
     m_table.erase(i);
@@ -450,58 +669,165 @@ size_t hash_map<Key, Mapped, Hash, Equals, Allocator>::erase(key_type const& key
   return 0;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::at(key_type const& key) -> mapped_type& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Predicate>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::retain(Predicate&& pred) {
+  return m_table.eraseIf([&pred](TableValue& value) { return !pred((value_type&)value); });
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::extract(const_iterator pos) -> node_type {
+  node_type node(m_table.hashAt(pos.inner), m_table.hashTag(), std::move(const_cast<TableValue&>(*pos.inner)));
+  m_table.erase(pos.inner);
+  return node;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::extract(key_type const& key) -> node_type {
+  auto i = m_table.find(key);
+  if (i == m_table.end())
+    return node_type();
+  return extract(const_iterator{i});
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(node_type&& node) -> insert_return_type {
+  if (node.empty())
+    return insert_return_type{end(), false, node_type()};
+  TableValue& value = node.storedValue();
+  size_t hash = m_table.transferredHash(node.hash(), node.hashTag(), value.first);
+  auto res = m_table.tryEmplaceHashed(hash, value.first, std::move(value));
+  if (!res.second)
+    return insert_return_type{iterator{res.first}, false, std::move(node)};
+  node = node_type();
+  return insert_return_type{iterator{res.first}, true, node_type()};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(const_iterator, node_type&& node) -> iterator {
+  return insert(std::move(node)).position;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::merge(hash_map& source) {
+  m_table.merge(source.m_table);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::merge(hash_map&& source) {
+  m_table.merge(source.m_table);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(key_type const& key) -> mapped_type& {
   auto i = m_table.find(key);
   if (i == m_table.end())
     throw std::out_of_range("no such key in hash_map");
   return i->second;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::at(key_type const& key) const -> mapped_type const& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(key_type const& key) const -> mapped_type const& {
   auto i = m_table.find(key);
   if (i == m_table.end())
     throw std::out_of_range("no such key in hash_map");
   return i->second;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::operator[](key_type const& key) -> mapped_type& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(K const& key) -> EnableTransparent<K, mapped_type&> {
   auto i = m_table.find(key);
-  if (i != m_table.end())
-    return i->second;
-  return m_table.insert({key, mapped_type()}).first->second;
+  if (i == m_table.end())
+    throw std::out_of_range("no such key in hash_map");
+  return i->second;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::operator[](key_type&& key) -> mapped_type& {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(K const& key) const -> EnableTransparent<K, mapped_type const&> {
   auto i = m_table.find(key);
-  if (i != m_table.end())
-    return i->second;
-  return m_table.insert({move(key), mapped_type()}).first->second;
+  if (i == m_table.end())
+    throw std::out_of_range("no such key in hash_map");
+  return i->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator[](key_type const& key) -> mapped_type& {
+  return try_emplace(key).first->second;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-size_t hash_map<Key, Mapped, Hash, Equals, Allocator>::count(key_type const& key) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator[](key_type&& key) -> mapped_type& {
+  return try_emplace(std::move(key)).first->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count(key_type const& key) const {
+  if (m_table.find(key) != m_table.end())
+    return 1;
+  else
+    return 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key) const -> const_iterator {
+  return const_iterator{m_table.find(key)};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key) -> iterator {
+  return iterator{m_table.find(key)};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::equal_range(key_type const& key) -> std::pair<iterator, iterator> {
+  auto i = find(key);
+  if (i != end()) {
+    auto j = i;
+    ++j;
+    return {i, j};
+  } else {
+    return {i, i};
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::equal_range(key_type const& key) const -> std::pair<const_iterator, const_iterator> {
+  auto i = find(key);
+  if (i != end()) {
+    auto j = i;
+    ++j;
+    return {i, j};
+  } else {
+    return {i, i};
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count(K const& key) const -> EnableTransparent<K, size_t> {
   if (m_table.find(key) != m_table.end())
     return 1;
   else
     return 0;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::find(key_type const& key) const -> const_iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(K const& key) const -> EnableTransparent<K, const_iterator> {
   return const_iterator{m_table.find(key)};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::find(key_type const& key) -> iterator {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(K const& key) -> EnableTransparent<K, iterator> {
   return iterator{m_table.find(key)};
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::equal_range(key_type const& key) -> std::pair<iterator, iterator> {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::equal_range(K const& key) -> EnableTransparent<K, std::pair<iterator, iterator>> {
   auto i = find(key);
   if (i != end()) {
     auto j = i;
@@ -512,8 +838,9 @@ auto hash_map<Key, Mapped, Hash, Equals, Allocator>::equal_range(key_type const&
   }
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-auto hash_map<Key, Mapped, Hash, Equals, Allocator>::equal_range(key_type const& key) const -> std::pair<const_iterator, const_iterator> {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::equal_range(K const& key) const -> EnableTransparent<K, std::pair<const_iterator, const_iterator>> {
   auto i = find(key);
   if (i != end()) {
     auto j = i;
@@ -524,19 +851,130 @@ auto hash_map<Key, Mapped, Hash, Equals, Allocator>::equal_range(key_type const&
   }
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-void hash_map<Key, Mapped, Hash, Equals, Allocator>::reserve(size_t capacity) {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename OutputIterator>
+OutputIterator hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find_many(KeyIterator first, KeyIterator last, OutputIterator out) const {
+  m_table.findEach(first, last, [&out](typename Table::const_iterator i) {
+      *out++ = const_iterator{i};
+    });
+  return out;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename OutputIterator>
+OutputIterator hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find_many(KeyIterator first, KeyIterator last, OutputIterator out) {
+  m_table.findEach(first, last, [&out](typename Table::iterator i) {
+      *out++ = iterator{i};
+    });
+  return out;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count_many(KeyIterator first, KeyIterator last) const {
+  return m_table.count_many(first, last);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::reserve(size_t capacity) {
   m_table.reserve(capacity);
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::operator==(hash_map const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::rehash(size_t bucketCount) {
+  m_table.rehash(bucketCount);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::shrink_to_fit() {
+  m_table.rehash(0);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::bucket_count() const {
+  return m_table.bucketCount();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::max_bucket_count() const {
+  return m_table.maxBucketCount();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+float hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::load_factor() const {
+  return (float)m_table.loadFactor();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+float hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::max_load_factor() const {
+  return (float)m_table.maxLoadFactor();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::max_load_factor(float loadFactor) {
+  m_table.setMaxLoadFactor(loadFactor);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table_stats hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::stats() const {
+  return m_table.stats();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::max_probe_distance() const {
+  return m_table.maxProbeDistance();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::max_probe_distance(size_t distance) {
+  m_table.setMaxProbeDistance(distance);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::bucket_seed() const {
+  return m_table.bucketSeed();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::for_each_bucket(Function&& function) const {
+  m_table.forEachBucket([&function](size_t hash, TableValue const* value) {
+      function(hash, (value_type const*)value);
+    });
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::emplace_unique_hashed(size_t hash, key_type&& key, Args&&... args) {
+  return m_table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)).second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator==(hash_map const& rhs) const {
   return m_table == rhs.m_table;
 }
 
-template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator>
-bool hash_map<Key, Mapped, Hash, Equals, Allocator>::operator!=(hash_map const& rhs) const {
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator!=(hash_map const& rhs) const {
   return m_table != rhs.m_table;
 }
 
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout, typename Predicate>
+size_t erase_if(hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>& map, Predicate pred) {
+  return map.retain([&pred](typename hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::value_type const& value) { return !pred(value); });
+}
+
+#if defined(FLAT_HASH_PMR)
+namespace pmr {
+
+// hash_map allocating from a std::pmr::memory_resource, which it also passes on
+// to keys and values that take an allocator, eg std::pmr::string, so an arena
+// can back both the buckets and what the values hold.
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Layout = inline_hash_layout>
+using hash_map = flat_hash::hash_map<Key, Mapped, Hash, Equals, std::pmr::polymorphic_allocator<Key>, Layout>;
+
+}
+#endif
+
 }
@@ -1,27 +1,224 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(FLAT_HASH_STATS)
+#include <atomic>
+#endif
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+// Set when std::pmr is available, and with it the flat_hash::pmr aliases.
+#define FLAT_HASH_PMR 1
+#endif
+#endif
 
 namespace flat_hash {
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
+// Bucket layout policies, given as the last template parameter of hash_table,
+// hash_map and hash_set.
+
+// Every bucket holds the value and the full hash of its key, and probing reads
+// the buckets themselves.  This is the simplest layout, and the default.
+struct inline_hash_layout {
+  static constexpr bool UseControl = false;
+  static constexpr bool StoreHash = true;
+};
+
+// Like inline_hash_layout, but also keeps a dense array of 2 byte control
+// words, one per bucket, holding the probe distance and a fingerprint of the
+// hash.  find compares a whole group of control words at once (8 with SSE2, 16
+// with AVX2) and only reads a bucket when both its distance and fingerprint
+// match, which helps most with large values and with finding missing keys.
+struct control_layout {
+  static constexpr bool UseControl = true;
+  static constexpr bool StoreHash = true;
+};
+
+// Keeps the control words of control_layout but not the full hash, so the
+// values are packed in an array of their own and a bucket costs only
+// sizeof(Value) + 2 bytes.  Since the full hash is gone, keys are hashed again
+// whenever the table grows, and when a probe distance is too long to fit in a
+// control word.
+struct compact_layout {
+  static constexpr bool UseControl = true;
+  static constexpr bool StoreHash = false;
+};
+
+template <typename... Types>
+struct make_void {
+  typedef void type;
+};
+
+// True when both Hash and Equals declare is_transparent, in which case lookups
+// accept any key type K they can hash and compare, not just the key type.
+template <typename Hash, typename Equals, typename K, typename = void>
+struct is_transparent_lookup : std::false_type {};
+
+template <typename Hash, typename Equals, typename K>
+struct is_transparent_lookup<Hash, Equals, K, typename make_void<typename Hash::is_transparent, typename Equals::is_transparent>::type>
+  : std::true_type {};
+
+// True when Hash declares is_avalanching, promising that every bit of its
+// result depends on every bit of the key, as with a good string hash.  Results
+// of other hashers are mixed before use (see hash_key).
+template <typename Hash, typename = void>
+struct is_avalanching : std::false_type {};
+
+template <typename Hash>
+struct is_avalanching<Hash, typename make_void<typename Hash::is_avalanching>::type> : std::true_type {};
+
+// Tables take bucket indexes from the low bits of a hash, and identity hashes
+// like std::hash of integers and pointers leave those bits equal for strided
+// keys, eg multiples of 1024 or aligned pointers.  Multiplying by 2^64 / phi
+// moves every bit of the hash into the high half of the product, and folding
+// that back onto the low half, as wyhash does, spreads them over the low bits
+// too.  Costs one multiply.
+constexpr size_t mix_hash(size_t hash) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t product = (__uint128_t)hash * 0x9e3779b97f4a7c15ull;
+  return (size_t)((uint64_t)product ^ (uint64_t)(product >> 64));
+#else
+  uint64_t product = (uint64_t)hash * 0x9e3779b97f4a7c15ull;
+  return (size_t)(product ^ (product >> 32));
+#endif
+}
+
+// The hash every table in this library uses for key: hash(key), mixed with
+// mix_hash unless Hash is avalanching.
+template <typename Hash, typename K>
+constexpr size_t hash_key(Hash const& hash, K const& key) {
+  return is_avalanching<Hash>::value ? hash(key) : mix_hash(hash(key));
+}
+
+// The bucket a hash targets among bucketCount, a power of two: its low bits,
+// or once a table has been reseeded (see hash_table::maxProbeDistance), those
+// of the hash mixed with the table's seed.
+inline size_t target_bucket(size_t hash, size_t seed, size_t bucketCount) {
+  return (seed == 0 ? hash : mix_hash(hash ^ seed)) & (bucketCount - 1);
+}
+
+// The shape of a table at the time stats() is called, for spotting bad
+// hashers.  The probe distance of a value is how far it sits past its target
+// bucket, finding it reads that many buckets plus one.
+struct hash_table_stats {
+  size_t size;
+  size_t bucketCount;
+  double loadFactor;
+  double meanProbeDistance;
+  size_t maxProbeDistance;
+  // How many values sit at each probe distance, from 0 to maxProbeDistance.
+  std::vector<size_t> probeDistanceHistogram;
+  // The most buckets in a row that are all filled.
+  size_t longestRun;
+  // The memory held by the bucket and control arrays, not counting anything
+  // the values allocate themselves.
+  size_t bytesUsed;
+
+  // Operation counters, only kept when FLAT_HASH_STATS is defined and
+  // otherwise zero.  Probes are the buckets a find or insert looks at, from
+  // the target bucket to the one it stops at.  Rehashes are the times the
+  // bucket array was reallocated.
+  uint64_t finds;
+  uint64_t findProbes;
+  uint64_t inserts;
+  uint64_t insertProbes;
+  uint64_t rehashes;
+  uint64_t rehashNanoseconds;
+};
+
+// The node_type of hash_map and hash_set, a value taken out of a table by
+// extract along with its stored hash.  Buckets are not nodes, so the value is
+// moved into the node and moved again when the node is inserted, but the key
+// is not hashed again when the node goes into a table of the same type,
+// unless it was reached through key() or value() and so may have changed.
+// Containers that differ only in their hasher or layout share the node type,
+// so a node remembers which type of table it came from, and any other type of
+// table hashes the key again.
+template <typename Value>
+class hash_node {
+public:
+  hash_node();
+  hash_node(hash_node&& rhs);
+  ~hash_node();
+
+  hash_node& operator=(hash_node&& rhs);
+
+  bool empty() const;
+  explicit operator bool() const;
+
+  // For hash_map nodes.
+  template <typename V = Value>
+  typename V::first_type& key() const;
+  template <typename V = Value>
+  typename V::second_type& mapped() const;
+  // For hash_set nodes, and the whole pair for hash_map nodes.
+  Value& value() const;
+
+  // Used by hash_map and hash_set.  hash is the stored hash of the value,
+  // which has the table's FilledHashBit set, and is zero once the key may
+  // have changed.  hashTag is the hash_table::hashTag of the table it was
+  // stored in.
+  hash_node(size_t hash, void const* hashTag, Value&& value);
+  size_t hash() const;
+  void const* hashTag() const;
+  // value() without forgetting the hash.
+  Value& storedValue() const;
+
+private:
+  bool m_filled;
+  mutable size_t m_hash;
+  void const* m_hashTag;
+  union {
+    mutable Value m_value;
+  };
+};
+
+// What hash_map and hash_set's insert(node_type&&) return, like the
+// insert_return_type of the standard containers.  node is empty unless the
+// key was already present.
+template <typename Iterator, typename Node>
+struct hash_insert_return {
+  Iterator position;
+  bool inserted;
+  Node node;
+};
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout = inline_hash_layout>
 struct hash_table {
 private:
+  static_assert(Layout::UseControl || Layout::StoreHash, "a layout without stored hashes needs control words");
+
   static size_t const NPos = (size_t)-1;
   static size_t const EmptyHashValue = 0;
   static size_t const EndHashValue = 1;
   static size_t const FilledHashBit = (size_t)1 << (sizeof(size_t) * 8 - 1);
 
-  struct Bucket {
-    Bucket();
-    ~Bucket();
+  struct HashedBucket {
+    HashedBucket();
+    ~HashedBucket();
 
-    Bucket(Bucket const& rhs);
-    Bucket(Bucket&& rhs);
+    HashedBucket(HashedBucket const& rhs);
+    HashedBucket(HashedBucket&& rhs);
 
-    Bucket& operator=(Bucket const& rhs);
-    Bucket& operator=(Bucket&& rhs);
+    HashedBucket& operator=(HashedBucket const& rhs);
+    HashedBucket& operator=(HashedBucket&& rhs);
 
     void setFilled(size_t hash, Value value);
     void setEmpty();
@@ -38,7 +235,47 @@ private:
     size_t hash;
   };
 
-  typedef std::vector<Bucket, typename Allocator::template rebind<Bucket>::other> Buckets;
+  // Buckets of compact_layout only hold the value.  Whether it is present is
+  // recorded in the control words, so the table constructs and destroys the
+  // values itself, and copying a CompactBucket does nothing.
+  struct CompactBucket {
+    CompactBucket();
+    ~CompactBucket();
+
+    CompactBucket(CompactBucket const& rhs);
+    CompactBucket& operator=(CompactBucket const& rhs);
+
+    union {
+      Value value;
+    };
+  };
+
+  typedef typename std::conditional<Layout::StoreHash, HashedBucket, CompactBucket>::type Bucket;
+  typedef std::vector<Bucket, typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket>> Buckets;
+  // Values are constructed through this, so that allocators like
+  // std::pmr::polymorphic_allocator can pass themselves on to the values.
+  typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Value> ValueAllocator;
+
+  // The low byte of a control word is the probe distance of the bucket plus
+  // one, so that zero means empty, and it saturates at MaxControlDistance.  The
+  // high byte is the fingerprint of the hash.  There is one extra control word
+  // past the last bucket which is never empty, so that iterators can scan the
+  // control words in the same way they would scan buckets.
+  typedef uint16_t Control;
+  typedef std::vector<Control, typename std::allocator_traits<Allocator>::template rebind_alloc<Control>> Controls;
+
+  static constexpr Control EmptyControl = 0;
+  static constexpr Control EndControl = 0xffff;
+  static constexpr size_t MaxControlDistance = 0xff;
+
+  typedef std::integral_constant<bool, Layout::UseControl> UseControl;
+
+  // One bit per bucket, set when it is filled, plus the bit of the end bucket
+  // which is always set.  Iterators skip 64 buckets per word of it rather than
+  // reading every bucket.  After these words comes a summary with one bit per
+  // word, set when the word is not zero, so that clear skips 4096 empty
+  // buckets at a time and costs little more than the values it removes.
+  typedef std::vector<uint64_t, typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t>> Occupancy;
 
 public:
   struct const_iterator {
@@ -52,6 +289,10 @@ public:
     Value const* operator->() const;
 
     Bucket const* current;
+    // The start of the buckets and of their occupancy bitmap, for finding the
+    // next filled bucket.
+    Bucket const* buckets;
+    uint64_t const* occupied;
   };
 
   struct iterator {
@@ -67,10 +308,19 @@ public:
     operator const_iterator() const;
 
     Bucket* current;
+    Bucket* buckets;
+    uint64_t const* occupied;
   };
 
   hash_table(size_t bucketCount, GetKey const& getKey, Hash const& hash, Equals const& equal, Allocator const& alloc);
 
+  hash_table(hash_table const& rhs);
+  hash_table(hash_table&& rhs);
+  ~hash_table();
+
+  hash_table& operator=(hash_table const& rhs);
+  hash_table& operator=(hash_table&& rhs);
+
   iterator begin();
   iterator end();
 
@@ -81,67 +331,419 @@ public:
   size_t size() const;
   void clear();
 
-  std::pair<iterator, bool> insert(Value value);
+  std::pair<iterator, bool> insert(Value const& value);
+  std::pair<iterator, bool> insert(Value&& value);
+  // If no value with the given key is present, constructs one from args
+  // directly in its final bucket, otherwise leaves args untouched.  Only probes
+  // once either way.  The constructed value must have a key equal to key.
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> tryEmplace(K const& key, Args&&... args);
+  // tryEmplace with the hash of key, as returned by hashKey, already known.
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> tryEmplaceHashed(size_t hash, K const& key, Args&&... args);
 
   iterator erase(const_iterator pos);
   iterator erase(const_iterator first, const_iterator last);
-
-  const_iterator find(Key const& key) const;
-  iterator find(Key const& key);
+  // Erases every value for which pred(value) returns true, in one pass over
+  // the buckets that shifts each run back once, however many of its values
+  // go, where erase shifts it back once per value.  Returns the number erased.
+  template <typename Predicate>
+  size_t eraseIf(Predicate&& pred);
+  // Moves every value of source whose key is not present into this table, in
+  // one sweep of source that erases them as eraseIf does, reusing their stored
+  // hashes as transferredHash allows.  Values whose keys are present stay in
+  // source.
+  void merge(hash_table& source);
+
+  // K is normally Key, hash_map and hash_set only pass other key types through
+  // when Hash and Equals are transparent.
+  template <typename K>
+  const_iterator find(K const& key) const;
+  template <typename K>
+  iterator find(K const& key);
+  template <typename K>
+  const_iterator findHashed(K const& key, size_t hash) const;
+  template <typename K>
+  iterator findHashed(K const& key, size_t hash);
+
+  // The table's hash of the given key, for callers that need it for their own
+  // purposes before passing it back to findHashed or tryEmplaceHashed.
+  template <typename K>
+  size_t hashKey(K const& key) const;
+  // The hash stored along with the value at pos, as hashKey returned for its
+  // key.
+  size_t hashAt(const_iterator pos) const;
+  // Identifies this type of table, and so how it hashes keys, to the tables
+  // that hash_node carries a stored hash to.
+  static void const* hashTag();
+  // The hash of key in this table, given its stored hash in a table with the
+  // given hashTag, or zero if that is unknown.  The same when the table is of
+  // this type and Hash has no state that may differ between the two,
+  // otherwise key is hashed again.
+  template <typename K>
+  size_t transferredHash(size_t hash, void const* hashTag, K const& key) const;
+
+  // Finds every key in [first, last) and writes one iterator per key to out,
+  // end() for missing keys.  Keys are hashed and their target buckets
+  // prefetched a batch at a time before any of them is probed, so the cache
+  // misses within a batch overlap instead of being paid one after another.
+  template <typename KeyIterator, typename OutputIterator>
+  OutputIterator find_many(KeyIterator first, KeyIterator last, OutputIterator out) const;
+  template <typename KeyIterator, typename OutputIterator>
+  OutputIterator find_many(KeyIterator first, KeyIterator last, OutputIterator out);
+  // Returns how many of the keys in [first, last) are present.
+  template <typename KeyIterator>
+  size_t count_many(KeyIterator first, KeyIterator last) const;
+  // Calls function with the find result for every key in [first, last), in
+  // order, using the same batched prefetching as find_many.
+  template <typename KeyIterator, typename Function>
+  void findEach(KeyIterator first, KeyIterator last, Function&& function) const;
+  template <typename KeyIterator, typename Function>
+  void findEach(KeyIterator first, KeyIterator last, Function&& function);
 
   void reserve(size_t capacity);
+  // Rebuilds the table with the fewest buckets that are at least bucketCount
+  // and hold every value within maxLoadFactor, which may shrink it.  Frees the
+  // buckets altogether if that is none.
+  void rehash(size_t bucketCount);
   Allocator getAllocator() const;
 
+  // Calls function(hash, value) for every bucket in order, not counting the
+  // end bucket, with the hash as stored for filled buckets and zero and a null
+  // value for empty ones.  For writing the buckets out as they are.
+  template <typename Function>
+  void forEachBucket(Function&& function) const;
+
+  // The number of buckets, not counting the end bucket.
+  size_t bucketCount() const;
+  // The most buckets the table can have, the largest power of two that the
+  // allocator can hold along with the end bucket.  Growing or rehashing past
+  // it throws std::length_error.
+  size_t maxBucketCount() const;
+  // The number of values the table can hold before it next grows.
+  size_t capacity() const;
+  double loadFactor() const;
+  // The fraction of the buckets that may be filled before the table grows,
+  // DefaultMaxFillLevel unless set, and clamped between MinMaxFillLevel and
+  // MaxMaxFillLevel.  Higher saves memory, lower shortens runs, which mostly
+  // speeds up finding missing keys.  Setting it grows the table if needed, but
+  // never shrinks it.
+  double maxLoadFactor() const;
+  void setMaxLoadFactor(double loadFactor);
+
+  // Walks every bucket, so costs about as much as iterating.
+  hash_table_stats stats() const;
+
+  // How far from its target bucket an insert may place a value, or move one
+  // along, before the table acts: the first time it rehashes with a random
+  // seed mixed into every hash, which breaks up clusters built from keys
+  // chosen to collide, and after that it grows, as long as it is at least
+  // MinGuardFillLevel full.  Past that only keys with equal full hashes can be
+  // that far apart, and nothing would help.  This bounds the buckets a find
+  // looks at.  Defaults to DefaultMaxProbeDistance.
+  size_t maxProbeDistance() const;
+  void setMaxProbeDistance(size_t distance);
+  // Zero until the table has been reseeded, then the seed target_bucket mixes
+  // into hashes.
+  size_t bucketSeed() const;
+
+  // Moves values from this table into target, which must use an equivalent
+  // hash function and have room for them, looking at no more than bucketLimit
+  // buckets.  Buckets are drained from the top down, starting just below the
+  // given bucket index, and the index to continue from is returned.  Start
+  // from bucketCount(), this table is drained once it is empty.  Used by
+  // incremental_hash_map to spread a growth out over many operations.
+  size_t migrateTo(hash_table& target, size_t bucket, size_t bucketLimit);
+  // Builds the buckets of an empty table with bucketCount buckets, a power of
+  // two, constructing no more than bucketLimit of them per call, so that
+  // incremental_hash_map can have its next array ready when it grows without
+  // paying for all of it in one operation.  Returns true once the table is
+  // ready, until then it must not be used for anything else.
+  bool prepareBuckets(size_t bucketCount, size_t bucketLimit);
+
+  // Inserts every value in [first, last), keeping the first of equal keys, by
+  // way of up to taskCount tasks.  run(count, task) must call task(i) once for
+  // every i in [0, count) and return when all are done, it may run them in
+  // parallel.  keyOf(*i) must return the key of a value without copying it.
+  // Values are hashed in parallel and partitioned by target bucket range, each
+  // range is filled in target bucket order by its own task, and the few values
+  // whose run spills past the end of their range are inserted afterwards.  The
+  // table must be empty for any of this to run in parallel.
+  template <typename RandomIt, typename KeyOf, typename RunTasks>
+  void bulkInsert(RandomIt first, RandomIt last, KeyOf const& keyOf, size_t taskCount, RunTasks&& run);
+
   bool operator==(hash_table const& rhs) const;
   bool operator!=(hash_table const& rhs) const;
 
 private:
   static constexpr size_t MinCapacity = 8;
-  static constexpr double MaxFillLevel = 0.7;
+  static constexpr double DefaultMaxFillLevel = 0.7;
+  // Robin hood probing needs at least one empty bucket, and runs grow long
+  // quickly past this.
+  static constexpr double MaxMaxFillLevel = 0.95;
+  static constexpr double MinMaxFillLevel = 0.1;
+  static constexpr size_t FindBatchSize = 16;
+  // bulkInsert does not split the buckets into ranges smaller than this, so
+  // that few runs cross from one range into the next.  Ranges are filled from
+  // different threads, so they must not share an occupancy word (64 buckets)
+  // or a word of its summary (64 * 64 buckets), whose bits setOccupied sets
+  // with a plain |=.
+  static constexpr size_t MinBulkRange = 4096;
+  static_assert(MinBulkRange % (64 * 64) == 0, "bulkInsert ranges must not share occupancy summary words");
+  static constexpr size_t BulkRadixBits = 10;
+  // Well past the longest probe a good hash gives even very large tables, and
+  // short enough that control words still hold the distance.
+  static constexpr size_t DefaultMaxProbeDistance = 128;
+  static constexpr double MinGuardFillLevel = 0.35;
 
   // Scans for the next bucket value that is non-empty
-  static Bucket* scan(Bucket* p);
-  static Bucket const* scan(Bucket const* p);
+  template <typename BucketPointer>
+  static void scan(BucketPointer& bucket, BucketPointer buckets, uint64_t const* occupied);
+
+  iterator bucketIterator(size_t bucket);
 
+  // Wraps a bucket index around the end of the bucket array.
   size_t hashBucket(size_t hash) const;
+  // The target bucket of a hash, see target_bucket.
+  size_t targetOf(size_t hash) const;
   size_t bucketError(size_t current, size_t target) const;
   void checkCapacity(size_t additionalCapacity);
+  // Moves every value into a new array of newSize buckets.
+  void rebuild(size_t newSize);
+  // Reseeds or grows the table as described at maxProbeDistance, returning
+  // false if it did neither.
+  bool guardProbeDistance();
+
+  // Returns the index of the bucket holding the given key, or NPos.
+  template <typename K>
+  size_t findBucket(K const& key, size_t hash) const;
+  template <typename K>
+  size_t findBucket(K const& key, size_t hash, std::true_type) const;
+  template <typename K>
+  size_t findBucket(K const& key, size_t hash, std::false_type) const;
+
+  // Whether the bucket at the given probe distance from the target bucket of
+  // hash holds the given key.
+  template <typename K>
+  bool bucketHolds(size_t bucket, size_t hash, size_t distance, K const& key) const;
+
+  // Empties the given bucket and shifts the rest of its run back by one.
+  void eraseBucket(size_t bucket);
+  // eraseIf with pred(bucket) given the index of a filled bucket.
+  template <typename Predicate>
+  size_t eraseBuckets(Predicate&& pred);
+
+  // Places a value from the table being grown, constructed from args.  The
+  // value is known not to be present and the capacity to be sufficient, and
+  // its hash is already known, so unlike insert this neither hashes nor
+  // compares keys.
+  template <typename... Args>
+  void relocate(size_t hash, Args&&... args);
+
+  // Moves every value in the run starting at the given bucket one bucket to the
+  // right, leaving it empty.
+  void shiftRight(size_t bucket);
+  // shiftRight with the empty bucket that ends the run already found.
+  void shiftRight(size_t bucket, size_t emptyBucket);
+
+  static bool bucketFilled(Buckets const& buckets, Controls const& control, size_t bucket);
+  static bool bucketFilled(Buckets const& buckets, Controls const& control, size_t bucket, std::true_type);
+  static bool bucketFilled(Buckets const& buckets, Controls const& control, size_t bucket, std::false_type);
+
+  bool bucketFilled(size_t bucket) const;
+  size_t bucketHash(size_t bucket) const;
+  size_t bucketDistance(size_t bucket) const;
+  // Places a value in an empty bucket.
+  template <typename... Args>
+  void fillBucket(size_t bucket, size_t hash, size_t distance, Args&&... args);
+  // Destroys the value in a filled bucket.
+  void emptyBucket(size_t bucket);
+  // Moves the value from a filled bucket into an empty one.
+  void moveBucket(size_t to, size_t from);
+  void setOccupied(size_t bucket);
+  void clearOccupied(size_t bucket);
+  // The number of words of m_occupied before the summary.
+  size_t occupiedWords() const;
+
+  // The parts of the above that depend on whether the buckets store the full
+  // hash.
+  size_t storedHash(HashedBucket const& bucket) const;
+  size_t storedHash(CompactBucket const& bucket) const;
+  bool storedHashMatches(HashedBucket const& bucket, size_t hash) const;
+  bool storedHashMatches(CompactBucket const& bucket, size_t hash) const;
+  template <typename... Args>
+  void constructValue(HashedBucket& bucket, size_t hash, Args&&... args);
+  template <typename... Args>
+  void constructValue(CompactBucket& bucket, size_t hash, Args&&... args);
+  static void destroyValue(HashedBucket& bucket);
+  static void destroyValue(CompactBucket& bucket);
+  static void moveValue(HashedBucket& to, HashedBucket& from);
+  static void moveValue(CompactBucket& to, CompactBucket& from);
+  static void setEndBucket(HashedBucket& bucket);
+  static void setEndBucket(CompactBucket& bucket);
+
+  // Fills this table, which must have no buckets, with the buckets of rhs,
+  // constructing every value from valueOf(bucket) with this table's
+  // allocator.
+  template <typename ValueOf>
+  void assignBuckets(hash_table const& rhs, ValueOf const& valueOf);
+  // compact_layout buckets do not destroy their values themselves.
+  void destroyValues();
+  // Calls function(bucket) for every filled bucket, in order, reading only the
+  // occupancy bitmap and its summary to find them.
+  template <typename Function>
+  void forEachFilled(Function&& function) const;
+
+  static Control fingerprint(size_t hash);
+  static Control makeControl(Control print, size_t distance);
+
+#if defined(FLAT_HASH_STATS)
+  // Bumped with relaxed loads and stores rather than atomic increments, which
+  // keeps them cheap and free of data races when several threads find at
+  // once, at the cost of losing counts when they do.
+  struct Counters {
+    std::atomic<uint64_t> finds{0};
+    std::atomic<uint64_t> findProbes{0};
+    std::atomic<uint64_t> inserts{0};
+    std::atomic<uint64_t> insertProbes{0};
+    std::atomic<uint64_t> rehashes{0};
+    std::atomic<uint64_t> rehashNanoseconds{0};
+  };
+
+  static void bumpCounter(std::atomic<uint64_t>& counter, uint64_t amount);
+  // The probes of a find for hash that ended at the given bucket or NPos.
+  size_t findProbeCount(size_t hash, size_t bucket) const;
+#endif
 
   Buckets m_buckets;
+  Controls m_control;
+  Occupancy m_occupied;
   size_t m_filledCount;
+  size_t m_seed;
+  size_t m_maxProbeDistance;
+  double m_maxFillLevel;
 
   GetKey m_getKey;
   Hash m_hash;
   Equals m_equals;
+
+#if defined(FLAT_HASH_STATS)
+  // Not copied or moved along with the values, every table counts its own.
+  mutable Counters m_counters;
+#endif
 };
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::Bucket() {
+template <typename Value>
+hash_node<Value>::hash_node()
+  : m_filled(false), m_hash(0), m_hashTag(nullptr) {}
+
+template <typename Value>
+hash_node<Value>::hash_node(hash_node&& rhs)
+  : m_filled(false), m_hash(0), m_hashTag(nullptr) {
+  operator=(std::move(rhs));
+}
+
+template <typename Value>
+hash_node<Value>::hash_node(size_t hash, void const* hashTag, Value&& value)
+  : m_filled(true), m_hash(hash), m_hashTag(hashTag) {
+  new (&m_value) Value(std::move(value));
+}
+
+template <typename Value>
+hash_node<Value>::~hash_node() {
+  if (m_filled)
+    m_value.~Value();
+}
+
+template <typename Value>
+auto hash_node<Value>::operator=(hash_node&& rhs) -> hash_node& {
+  if (this != &rhs) {
+    if (m_filled)
+      m_value.~Value();
+    m_filled = rhs.m_filled;
+    m_hash = rhs.m_hash;
+    m_hashTag = rhs.m_hashTag;
+    if (m_filled) {
+      new (&m_value) Value(std::move(rhs.m_value));
+      rhs.m_value.~Value();
+      rhs.m_filled = false;
+      rhs.m_hash = 0;
+    }
+  }
+  return *this;
+}
+
+template <typename Value>
+bool hash_node<Value>::empty() const {
+  return !m_filled;
+}
+
+template <typename Value>
+hash_node<Value>::operator bool() const {
+  return m_filled;
+}
+
+template <typename Value>
+template <typename V>
+typename V::first_type& hash_node<Value>::key() const {
+  m_hash = 0;
+  return m_value.first;
+}
+
+template <typename Value>
+template <typename V>
+typename V::second_type& hash_node<Value>::mapped() const {
+  return m_value.second;
+}
+
+template <typename Value>
+Value& hash_node<Value>::value() const {
+  m_hash = 0;
+  return m_value;
+}
+
+template <typename Value>
+size_t hash_node<Value>::hash() const {
+  return m_hash;
+}
+
+template <typename Value>
+void const* hash_node<Value>::hashTag() const {
+  return m_hashTag;
+}
+
+template <typename Value>
+Value& hash_node<Value>::storedValue() const {
+  return m_value;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::HashedBucket() {
   this->hash = EmptyHashValue;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::~Bucket() {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::~HashedBucket() {
   if (auto s = valuePtr())
     s->~Value();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::Bucket(Bucket const& rhs) {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::HashedBucket(HashedBucket const& rhs) {
   this->hash = rhs.hash;
   if (auto o = rhs.valuePtr())
     new (&this->value) Value(*o);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::Bucket(Bucket&& rhs) {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::HashedBucket(HashedBucket&& rhs) {
   this->hash = rhs.hash;
   if (auto o = rhs.valuePtr())
     new (&this->value) Value(std::move(*o));
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::operator=(Bucket const& rhs) -> Bucket& {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::operator=(HashedBucket const& rhs) -> HashedBucket& {
   if (auto o = rhs.valuePtr()) {
     if (auto s = valuePtr())
       *s = *o;
@@ -155,8 +757,8 @@ auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::operator=(
   return *this;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::operator=(Bucket&& rhs) -> Bucket& {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::operator=(HashedBucket&& rhs) -> HashedBucket& {
   if (auto o = rhs.valuePtr()) {
     if (auto s = valuePtr())
       *s = std::move(*o);
@@ -170,8 +772,8 @@ auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::operator=(
   return *this;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::setFilled(size_t hash, Value value) {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::setFilled(size_t hash, Value value) {
   if (auto s = valuePtr())
     *s = std::move(value);
   else
@@ -179,356 +781,956 @@ void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::setFilled(
   this->hash = hash | FilledHashBit;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::setEmpty() {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::setEmpty() {
   if (auto s = valuePtr())
     s->~Value();
   this->hash = EmptyHashValue;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::setEnd() {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::setEnd() {
   if (auto s = valuePtr())
     s->~Value();
   this->hash = EndHashValue;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-Value const* hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::valuePtr() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+Value const* hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::valuePtr() const {
   if (hash & FilledHashBit)
     return &this->value;
   return nullptr;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-Value* hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::valuePtr() {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+Value* hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::valuePtr() {
   if (hash & FilledHashBit)
     return &this->value;
   return nullptr;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::isEmpty() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::isEmpty() const {
   return this->hash == EmptyHashValue;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::Bucket::isEnd() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::HashedBucket::isEnd() const {
   return this->hash == EndHashValue;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator==(const_iterator const& rhs) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::CompactBucket::CompactBucket() {}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::CompactBucket::~CompactBucket() {}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::CompactBucket::CompactBucket(CompactBucket const&) {}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::CompactBucket::operator=(CompactBucket const&) -> CompactBucket& {
+  return *this;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator==(const_iterator const& rhs) const {
   return current == rhs.current;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator!=(const_iterator const& rhs) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator!=(const_iterator const& rhs) const {
   return current != rhs.current;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator++() -> const_iterator& {
-  current = scan(++current);
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator++() -> const_iterator& {
+  ++current;
+  scan(current, buckets, occupied);
   return *this;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator++(int) -> const_iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator++(int) -> const_iterator {
   const_iterator copy(*this);
   operator++();
   return copy;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator*() const -> Value const& {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator*() const -> Value const& {
   return *operator->();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator::operator->() const -> Value const* {
-  return current->valuePtr();
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator::operator->() const -> Value const* {
+  return &current->value;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator==(iterator const& rhs) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator==(iterator const& rhs) const {
   return current == rhs.current;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator!=(iterator const& rhs) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator!=(iterator const& rhs) const {
   return current != rhs.current;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator++() -> iterator& {
-  current = scan(++current);
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator++() -> iterator& {
+  ++current;
+  scan(current, buckets, occupied);
   return *this;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator++(int) -> iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator++(int) -> iterator {
   iterator copy(*this);
   operator++();
   return copy;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator*() const -> Value& {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator*() const -> Value& {
   return *operator->();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator->() const -> Value* {
-  return current->valuePtr();
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator->() const -> Value* {
+  return &current->value;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::iterator::operator typename hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::const_iterator() const {
-  return const_iterator{current};
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::iterator::operator typename hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::const_iterator() const {
+  return const_iterator{current, buckets, occupied};
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::hash_table(size_t bucketCount,
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hash_table(size_t bucketCount,
     GetKey const& getKey, Hash const& hash, Equals const& equal, Allocator const& alloc)
-  : m_buckets(alloc), m_filledCount(0), m_getKey(getKey),
-    m_hash(hash), m_equals(equal) {
+  : m_buckets(alloc), m_control(alloc), m_occupied(alloc), m_filledCount(0), m_seed(0), m_maxProbeDistance(DefaultMaxProbeDistance),
+    m_maxFillLevel(DefaultMaxFillLevel), m_getKey(getKey), m_hash(hash), m_equals(equal) {
   if (bucketCount != 0)
     checkCapacity(bucketCount);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::begin() -> iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hash_table(hash_table const& rhs)
+  : m_buckets(std::allocator_traits<typename Buckets::allocator_type>::select_on_container_copy_construction(rhs.m_buckets.get_allocator())),
+    m_control(std::allocator_traits<typename Controls::allocator_type>::select_on_container_copy_construction(rhs.m_control.get_allocator())),
+    m_occupied(std::allocator_traits<typename Occupancy::allocator_type>::select_on_container_copy_construction(rhs.m_occupied.get_allocator())),
+    m_filledCount(0), m_seed(0), m_maxProbeDistance(0), m_maxFillLevel(0), m_getKey(rhs.m_getKey), m_hash(rhs.m_hash), m_equals(rhs.m_equals) {
+  assignBuckets(rhs, [&rhs](size_t bucket) -> Value const& {
+      return rhs.m_buckets[bucket].value;
+    });
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hash_table(hash_table&& rhs)
+  : m_buckets(std::move(rhs.m_buckets)), m_control(std::move(rhs.m_control)), m_occupied(std::move(rhs.m_occupied)),
+    m_filledCount(rhs.m_filledCount),
+    m_seed(rhs.m_seed), m_maxProbeDistance(rhs.m_maxProbeDistance), m_maxFillLevel(rhs.m_maxFillLevel), m_getKey(std::move(rhs.m_getKey)), m_hash(std::move(rhs.m_hash)), m_equals(std::move(rhs.m_equals)) {
+  rhs.m_buckets.clear();
+  rhs.m_control.clear();
+  rhs.m_occupied.clear();
+  rhs.m_filledCount = 0;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::~hash_table() {
+  destroyValues();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::operator=(hash_table const& rhs) -> hash_table& {
+  if (this != &rhs) {
+    destroyValues();
+    m_buckets.clear();
+    m_control.clear();
+    m_occupied.clear();
+    if (std::allocator_traits<typename Buckets::allocator_type>::propagate_on_container_copy_assignment::value) {
+      m_buckets = Buckets(rhs.m_buckets.get_allocator());
+      m_control = Controls(rhs.m_control.get_allocator());
+      m_occupied = Occupancy(rhs.m_occupied.get_allocator());
+    }
+    m_getKey = rhs.m_getKey;
+    m_hash = rhs.m_hash;
+    m_equals = rhs.m_equals;
+    assignBuckets(rhs, [&rhs](size_t bucket) -> Value const& {
+        return rhs.m_buckets[bucket].value;
+      });
+  }
+  return *this;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::operator=(hash_table&& rhs) -> hash_table& {
+  if (this != &rhs) {
+    destroyValues();
+    m_getKey = std::move(rhs.m_getKey);
+    m_hash = std::move(rhs.m_hash);
+    m_equals = std::move(rhs.m_equals);
+    if (std::allocator_traits<typename Buckets::allocator_type>::propagate_on_container_move_assignment::value
+        || m_buckets.get_allocator() == rhs.m_buckets.get_allocator()) {
+      m_buckets = std::move(rhs.m_buckets);
+      m_control = std::move(rhs.m_control);
+      m_occupied = std::move(rhs.m_occupied);
+      m_filledCount = rhs.m_filledCount;
+      m_seed = rhs.m_seed;
+      m_maxProbeDistance = rhs.m_maxProbeDistance;
+      m_maxFillLevel = rhs.m_maxFillLevel;
+    } else {
+      // The buckets cannot change hands, and moving the values into new ones
+      // must go through this table's allocator.
+      m_buckets.clear();
+      m_control.clear();
+      m_occupied.clear();
+      assignBuckets(rhs, [&rhs](size_t bucket) -> Value&& {
+          return std::move(rhs.m_buckets[bucket].value);
+        });
+      rhs.destroyValues();
+    }
+    rhs.m_buckets.clear();
+    rhs.m_control.clear();
+    rhs.m_occupied.clear();
+    rhs.m_filledCount = 0;
+  }
+  return *this;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::begin() -> iterator {
   if (m_buckets.empty())
     return end();
-  return iterator{scan(m_buckets.data())};
+  iterator i = bucketIterator(0);
+  scan(i.current, i.buckets, i.occupied);
+  return i;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::end() -> iterator {
-  return iterator{m_buckets.data() + m_buckets.size() - 1};
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::end() -> iterator {
+  if (m_buckets.empty())
+    return iterator{nullptr, nullptr, nullptr};
+  return bucketIterator(m_buckets.size() - 1);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::begin() const -> const_iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::begin() const -> const_iterator {
   return const_cast<hash_table*>(this)->begin();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::end() const -> const_iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::end() const -> const_iterator {
   return const_cast<hash_table*>(this)->end();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::empty() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::empty() const {
   return m_filledCount == 0;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::size() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::size() const {
   return m_filledCount;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::clear() {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::clear() {
   if (m_buckets.empty())
     return;
 
-  for (size_t i = 0; i < m_buckets.size() - 1; ++i)
-    m_buckets[i].setEmpty();
+  forEachFilled([this](size_t bucket) { emptyBucket(bucket); });
   m_filledCount = 0;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::insert(Value value) -> std::pair<iterator, bool> {
-  if (m_buckets.empty() || m_filledCount + 1 > (m_buckets.size() - 1) * MaxFillLevel)
-    checkCapacity(1);
-
-  size_t hash = m_hash(m_getKey(value)) | FilledHashBit;
-  size_t targetBucket = hashBucket(hash);
-  size_t currentBucket = targetBucket;
-  size_t insertedBucket = NPos;
-
-  while (true) {
-    auto& target = m_buckets[currentBucket];
-    if (auto entryValue = target.valuePtr()) {
-      if (target.hash == hash && m_equals(m_getKey(*entryValue), m_getKey(value)))
-        return std::make_pair(iterator{m_buckets.data() + currentBucket}, false);
-
-      size_t entryTargetBucket = hashBucket(target.hash);
-      size_t entryError = bucketError(currentBucket, entryTargetBucket);
-      size_t addError = bucketError(currentBucket, targetBucket);
-      if (addError > entryError) {
-        if (insertedBucket == NPos)
-          insertedBucket = currentBucket;
-
-        std::swap(value, *entryValue);
-        std::swap(hash, target.hash);
-        targetBucket = entryTargetBucket;
-      }
-      currentBucket = hashBucket(currentBucket + 1);
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::insert(Value const& value) -> std::pair<iterator, bool> {
+  return tryEmplace(m_getKey(value), value);
+}
 
-    } else {
-      target.setFilled(hash, std::move(value));
-      ++m_filledCount;
-      if (insertedBucket == NPos)
-        insertedBucket = currentBucket;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::insert(Value&& value) -> std::pair<iterator, bool> {
+  return tryEmplace(m_getKey(value), std::move(value));
+}
 
-      return std::make_pair(iterator{m_buckets.data() + insertedBucket}, true);
-    }
-  }
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K, typename... Args>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::tryEmplace(K const& key, Args&&... args) -> std::pair<iterator, bool> {
+  return tryEmplaceHashed(hash_key(m_hash, key), key, std::forward<Args>(args)...);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::erase(const_iterator pos) -> iterator {
-  size_t bucketIndex = pos.current - m_buckets.data();
-  size_t currentBucketIndex = bucketIndex;
-  auto currentBucket = &m_buckets[currentBucketIndex];
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K, typename... Args>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::tryEmplaceHashed(size_t hash, K const& key, Args&&... args) -> std::pair<iterator, bool> {
+  if (m_buckets.empty())
+    checkCapacity(1);
 
+  hash |= FilledHashBit;
   while (true) {
-    size_t nextBucketIndex = hashBucket(currentBucketIndex + 1);
-    auto nextBucket = &m_buckets[nextBucketIndex];
-    if (auto nextPtr = nextBucket->valuePtr()) {
-      if (bucketError(nextBucketIndex, nextBucket->hash) > 0) {
-        currentBucket->hash = nextBucket->hash;
-        *currentBucket->valuePtr() = std::move(*nextPtr);
-        currentBucketIndex = nextBucketIndex;
-        currentBucket = nextBucket;
-      } else {
+    size_t currentBucket = targetOf(hash);
+    size_t distance = 0;
+
+    // The new value goes in the first bucket that is either empty or holds a
+    // value closer to its own target bucket, and everything after it in the
+    // run moves one bucket to the right, which keeps every run ordered by
+    // target bucket.
+    while (bucketFilled(currentBucket)) {
+      size_t entryDistance = bucketDistance(currentBucket);
+      if (entryDistance < distance)
         break;
+
+      if (entryDistance == distance && bucketHolds(currentBucket, hash, distance, key)) {
+#if defined(FLAT_HASH_STATS)
+        bumpCounter(m_counters.inserts, 1);
+        bumpCounter(m_counters.insertProbes, distance + 1);
+#endif
+        return std::make_pair(bucketIterator(currentBucket), false);
       }
-    } else {
-      break;
+
+      currentBucket = hashBucket(currentBucket + 1);
+      ++distance;
+    }
+
+    // Only grow once the key is known to be missing, as key may otherwise
+    // refer to a value in this table that growing would move.
+    if (m_filledCount + 1 > (m_buckets.size() - 1) * m_maxFillLevel) {
+      checkCapacity(1);
+      continue;
     }
+
+    // The rest of the run moves one bucket further from its targets.
+    bool tooFar = distance > m_maxProbeDistance;
+    size_t emptyBucket = currentBucket;
+    for (; bucketFilled(emptyBucket); emptyBucket = hashBucket(emptyBucket + 1))
+      tooFar = tooFar || bucketDistance(emptyBucket) >= m_maxProbeDistance;
+    if (tooFar && guardProbeDistance())
+      continue;
+
+#if defined(FLAT_HASH_STATS)
+    bumpCounter(m_counters.inserts, 1);
+    bumpCounter(m_counters.insertProbes, distance + 1);
+#endif
+    shiftRight(currentBucket, emptyBucket);
+    fillBucket(currentBucket, hash, distance, std::forward<Args>(args)...);
+    ++m_filledCount;
+
+    return std::make_pair(bucketIterator(currentBucket), true);
   }
+}
 
-  m_buckets[currentBucketIndex].setEmpty();
-  --m_filledCount;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::erase(const_iterator pos) -> iterator {
+  size_t bucketIndex = pos.current - m_buckets.data();
+  eraseBucket(bucketIndex);
 
-  return iterator{scan(m_buckets.data() + bucketIndex)};
+  iterator i = bucketIterator(bucketIndex);
+  scan(i.current, i.buckets, i.occupied);
+  return i;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::erase(const_iterator first, const_iterator last) -> iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::erase(const_iterator first, const_iterator last) -> iterator {
   while (first != last)
     first = erase(first);
-  return iterator{(Bucket*)first.current};
+  return iterator{(Bucket*)first.current, (Bucket*)first.buckets, first.occupied};
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Predicate>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::eraseIf(Predicate&& pred) {
+  return eraseBuckets([this, &pred](size_t bucket) { return pred(m_buckets[bucket].value); });
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::find(Key const& key) const -> const_iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::merge(hash_table& source) {
+  if (&source == this)
+    return;
+  source.eraseBuckets([this, &source](size_t bucket) {
+      Value& value = source.m_buckets[bucket].value;
+      Key const& key = m_getKey(value);
+      return tryEmplaceHashed(transferredHash(source.bucketHash(bucket), hashTag(), key), key, std::move(value)).second;
+    });
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::find(K const& key) const -> const_iterator {
   return const_cast<hash_table*>(this)->find(key);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::find(Key const& key) -> iterator {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::find(K const& key) -> iterator {
+  return findHashed(key, hash_key(m_hash, key));
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findHashed(K const& key, size_t hash) const -> const_iterator {
+  return const_cast<hash_table*>(this)->findHashed(key, hash);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findHashed(K const& key, size_t hash) -> iterator {
   if (m_buckets.empty())
     return end();
 
-  size_t hash = m_hash(key) | FilledHashBit;
-  size_t targetBucket = hashBucket(hash);
-  size_t currentBucket = targetBucket;
-  while (true) {
-    auto& bucket = m_buckets[currentBucket];
-    if (auto value = bucket.valuePtr()) {
-      if (bucket.hash == hash && m_equals(m_getKey(*value), key))
-        return iterator{m_buckets.data() + currentBucket};
+  size_t bucket = findBucket(key, hash | FilledHashBit);
+#if defined(FLAT_HASH_STATS)
+  bumpCounter(m_counters.finds, 1);
+  bumpCounter(m_counters.findProbes, findProbeCount(hash | FilledHashBit, bucket));
+#endif
+  if (bucket == NPos)
+    return end();
+  return bucketIterator(bucket);
+}
 
-      size_t entryError = bucketError(currentBucket, bucket.hash);
-      size_t findError = bucketError(currentBucket, targetBucket);
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hashKey(K const& key) const {
+  return hash_key(m_hash, key);
+}
 
-      if (findError > entryError)
-        return end();
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hashAt(const_iterator pos) const {
+  return storedHash(*pos.current);
+}
 
-      currentBucket = hashBucket(currentBucket + 1);
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void const* hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hashTag() {
+  // Every instantiation has its own copy of this.
+  static char const tag = 0;
+  return &tag;
+}
 
-    } else {
-      return end();
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::transferredHash(size_t hash, void const* hashTag, K const& key) const {
+  if (hash != 0 && hashTag == hash_table::hashTag() && std::is_empty<Hash>::value)
+    return hash;
+  return hash_key(m_hash, key);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename OutputIterator>
+OutputIterator hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::find_many(KeyIterator first, KeyIterator last, OutputIterator out) const {
+  findEach(first, last, [&out](const_iterator i) {
+      *out++ = i;
+    });
+  return out;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename OutputIterator>
+OutputIterator hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::find_many(KeyIterator first, KeyIterator last, OutputIterator out) {
+  findEach(first, last, [&out](iterator i) {
+      *out++ = i;
+    });
+  return out;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::count_many(KeyIterator first, KeyIterator last) const {
+  size_t count = 0;
+  auto e = end();
+  findEach(first, last, [&](const_iterator i) {
+      if (i != e)
+        ++count;
+    });
+  return count;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename Function>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findEach(KeyIterator first, KeyIterator last, Function&& function) const {
+  const_cast<hash_table*>(this)->findEach(first, last, [&function](iterator i) {
+      function(const_iterator(i));
+    });
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename KeyIterator, typename Function>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findEach(KeyIterator first, KeyIterator last, Function&& function) {
+  if (m_buckets.empty()) {
+    for (; first != last; ++first)
+      function(end());
+    return;
+  }
+
+  KeyIterator keys[FindBatchSize];
+  size_t hashes[FindBatchSize];
+
+  while (first != last) {
+    size_t batchSize = 0;
+    for (; first != last && batchSize < FindBatchSize; ++first, ++batchSize) {
+      size_t hash = hash_key(m_hash, *first) | FilledHashBit;
+      size_t targetBucket = targetOf(hash);
+      if (Layout::UseControl)
+        __builtin_prefetch(m_control.data() + targetBucket);
+      __builtin_prefetch(m_buckets.data() + targetBucket);
+      keys[batchSize] = first;
+      hashes[batchSize] = hash;
+    }
+
+    for (size_t i = 0; i < batchSize; ++i) {
+      size_t bucket = findBucket(*keys[i], hashes[i]);
+#if defined(FLAT_HASH_STATS)
+      bumpCounter(m_counters.finds, 1);
+      bumpCounter(m_counters.findProbes, findProbeCount(hashes[i], bucket));
+#endif
+      if (bucket == NPos)
+        function(end());
+      else
+        function(bucketIterator(bucket));
     }
   }
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::reserve(size_t capacity) {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::reserve(size_t capacity) {
   if (capacity > m_filledCount)
     checkCapacity(capacity - m_filledCount);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-Allocator hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::getAllocator() const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::rehash(size_t bucketCount) {
+  if (bucketCount == 0 && m_filledCount == 0) {
+    m_buckets = Buckets(m_buckets.get_allocator());
+    m_control = Controls(m_control.get_allocator());
+    m_occupied = Occupancy(m_occupied.get_allocator());
+    return;
+  }
+
+  size_t newSize = MinCapacity;
+  while (newSize < bucketCount || (double)m_filledCount / (double)newSize > m_maxFillLevel) {
+    if (newSize >= maxBucketCount())
+      throw std::length_error("hash table bucket count over max_bucket_count()");
+    newSize *= 2;
+  }
+
+  if (newSize != this->bucketCount())
+    rebuild(newSize);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+Allocator hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::getAllocator() const {
   return m_buckets.get_allocator();
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::operator==(hash_table const& rhs) const {
-  if (size() != rhs.size())
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketCount() const {
+  if (m_buckets.empty())
+    return 0;
+  return m_buckets.size() - 1;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::maxBucketCount() const {
+  size_t limit = m_buckets.max_size() - 1;
+  if (Layout::UseControl)
+    limit = std::min(limit, m_control.max_size() - 1);
+  size_t maxCount = MinCapacity;
+  while (maxCount <= limit / 2)
+    maxCount *= 2;
+  return maxCount;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::forEachBucket(Function&& function) const {
+  for (size_t bucket = 0; bucket < bucketCount(); ++bucket) {
+    if (bucketFilled(bucket))
+      function(bucketHash(bucket), &m_buckets[bucket].value);
+    else
+      function((size_t)0, (Value const*)nullptr);
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::capacity() const {
+  return (size_t)(bucketCount() * m_maxFillLevel);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::loadFactor() const {
+  return bucketCount() == 0 ? 0.0 : (double)m_filledCount / (double)bucketCount();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::maxLoadFactor() const {
+  return m_maxFillLevel;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::setMaxLoadFactor(double loadFactor) {
+  m_maxFillLevel = std::min(std::max(loadFactor, MinMaxFillLevel), MaxMaxFillLevel);
+  if (!m_buckets.empty())
+    checkCapacity(0);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+hash_table_stats hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::stats() const {
+  hash_table_stats stats = {};
+  stats.size = m_filledCount;
+  stats.bucketCount = bucketCount();
+  stats.loadFactor = stats.bucketCount == 0 ? 0.0 : (double)m_filledCount / (double)stats.bucketCount;
+  stats.bytesUsed = m_buckets.capacity() * sizeof(Bucket) + m_control.capacity() * sizeof(Control)
+      + m_occupied.capacity() * sizeof(uint64_t);
+
+  size_t totalDistance = 0;
+  size_t run = 0;
+  size_t firstRun = 0;
+  for (size_t bucket = 0; bucket < stats.bucketCount; ++bucket) {
+    if (!bucketFilled(bucket)) {
+      if (run == bucket)
+        firstRun = run;
+      run = 0;
+      continue;
+    }
+    size_t distance = bucketDistance(bucket);
+    if (distance >= stats.probeDistanceHistogram.size())
+      stats.probeDistanceHistogram.resize(distance + 1);
+    ++stats.probeDistanceHistogram[distance];
+    totalDistance += distance;
+    stats.longestRun = std::max(stats.longestRun, ++run);
+  }
+  // The run at the end wraps around into the one at the start.
+  if (run != stats.bucketCount)
+    stats.longestRun = std::max(stats.longestRun, run + firstRun);
+
+  if (m_filledCount != 0) {
+    stats.meanProbeDistance = (double)totalDistance / (double)m_filledCount;
+    stats.maxProbeDistance = stats.probeDistanceHistogram.size() - 1;
+  }
+
+#if defined(FLAT_HASH_STATS)
+  stats.finds = m_counters.finds.load(std::memory_order_relaxed);
+  stats.findProbes = m_counters.findProbes.load(std::memory_order_relaxed);
+  stats.inserts = m_counters.inserts.load(std::memory_order_relaxed);
+  stats.insertProbes = m_counters.insertProbes.load(std::memory_order_relaxed);
+  stats.rehashes = m_counters.rehashes.load(std::memory_order_relaxed);
+  stats.rehashNanoseconds = m_counters.rehashNanoseconds.load(std::memory_order_relaxed);
+#endif
+  return stats;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::maxProbeDistance() const {
+  return m_maxProbeDistance;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::setMaxProbeDistance(size_t distance) {
+  m_maxProbeDistance = distance;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketSeed() const {
+  return m_seed;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::migrateTo(hash_table& target, size_t bucket, size_t bucketLimit) {
+  for (; bucket > 0 && bucketLimit > 0; --bucketLimit) {
+    // Erasing the top bucket of a run that wraps around pulls the next value
+    // back into it, so only move on once the bucket stays empty.
+    if (!bucketFilled(bucket - 1)) {
+      --bucket;
+      continue;
+    }
+
+    if (target.m_buckets.empty() || target.m_filledCount + 1 > (target.m_buckets.size() - 1) * target.m_maxFillLevel)
+      target.checkCapacity(1);
+    target.relocate(bucketHash(bucket - 1), std::move(m_buckets[bucket - 1].value));
+    ++target.m_filledCount;
+    eraseBucket(bucket - 1);
+  }
+  return bucket;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::prepareBuckets(size_t bucketCount, size_t bucketLimit) {
+  size_t words = bucketCount / 64 + 1;
+  size_t occupiedSize = words + words / 64 + 1;
+  if (m_buckets.size() == bucketCount + 1)
+    return true;
+
+  // Allocate everything up front, only constructing the buckets is spread
+  // out, the pages of a large allocation are not touched until then.
+  if (m_buckets.empty()) {
+    m_buckets.reserve(bucketCount + 1);
+    if (Layout::UseControl)
+      m_control.reserve(bucketCount + 1);
+    m_occupied.reserve(occupiedSize);
+  }
+
+  size_t built = std::min(m_buckets.size() + bucketLimit, bucketCount);
+  m_buckets.resize(built);
+  if (Layout::UseControl)
+    m_control.resize(built, EmptyControl);
+  m_occupied.resize(std::min(m_occupied.size() + bucketLimit / 64 + 1, occupiedSize), 0);
+  if (built < bucketCount || m_occupied.size() < occupiedSize)
     return false;
 
-  auto i = begin();
-  auto j = rhs.begin();
-  auto e = end();
+  m_buckets.resize(bucketCount + 1);
+  setEndBucket(m_buckets[bucketCount]);
+  if (Layout::UseControl)
+    m_control.resize(bucketCount + 1, EndControl);
+  setOccupied(bucketCount);
+  return true;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename RandomIt, typename KeyOf, typename RunTasks>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bulkInsert(RandomIt first, RandomIt last, KeyOf const& keyOf, size_t taskCount, RunTasks&& run) {
+  size_t count = last - first;
+  reserve(m_filledCount + count);
+
+  size_t bucketCount = m_buckets.size() - 1;
+  size_t rangeCount = 1;
+  while (rangeCount * 2 <= taskCount && bucketCount / (rangeCount * 2) >= MinBulkRange)
+    rangeCount *= 2;
+
+  if (m_filledCount != 0 || rangeCount == 1) {
+    for (auto i = first; i != last; ++i)
+      tryEmplace(keyOf(*i), *i);
+    return;
+  }
+
+  size_t rangeShift = 0;
+  while ((bucketCount / rangeCount) >> rangeShift > 1)
+    ++rangeShift;
+
+  // Hash every value and count how many from each chunk of the input target
+  // each bucket range.
+  std::vector<size_t> hashes(count);
+  std::vector<size_t> offsets(rangeCount * rangeCount);
+  run(rangeCount, [&](size_t chunk) {
+      size_t* chunkOffsets = offsets.data() + chunk * rangeCount;
+      for (size_t i = count * chunk / rangeCount; i < count * (chunk + 1) / rangeCount; ++i) {
+        hashes[i] = hash_key(m_hash, keyOf(first[i])) | FilledHashBit;
+        ++chunkOffsets[targetOf(hashes[i]) >> rangeShift];
+      }
+    });
+
+  // Lay out the values of each range one after another, and within a range
+  // by chunk, so that equal keys keep their order from the input.
+  std::vector<size_t> rangeBegin(rangeCount + 1);
+  size_t total = 0;
+  for (size_t range = 0; range < rangeCount; ++range) {
+    rangeBegin[range] = total;
+    for (size_t chunk = 0; chunk < rangeCount; ++chunk) {
+      size_t chunkCount = offsets[chunk * rangeCount + range];
+      offsets[chunk * rangeCount + range] = total;
+      total += chunkCount;
+    }
+  }
+  rangeBegin[rangeCount] = total;
+
+  // Pairs of hash and index of the value, so that the ranges never need to go
+  // back to hashes.
+  std::vector<std::pair<size_t, size_t>> order(count);
+  run(rangeCount, [&](size_t chunk) {
+      size_t* chunkOffsets = offsets.data() + chunk * rangeCount;
+      for (size_t i = count * chunk / rangeCount; i < count * (chunk + 1) / rangeCount; ++i)
+        order[chunkOffsets[targetOf(hashes[i]) >> rangeShift]++] = std::make_pair(hashes[i], i);
+    });
+  std::vector<size_t>().swap(hashes);
+
+  // Within a range, sort by target bucket and give every value the first free
+  // bucket at or after its target, which is exactly where inserting them one
+  // by one would have left them.  Values that would land past the end of the
+  // range are left for afterwards.
+  std::vector<size_t> filled(rangeCount);
+  std::vector<std::vector<std::pair<size_t, size_t>>> spilled(rangeCount);
+  run(rangeCount, [&](size_t range) {
+      size_t rangeSize = bucketCount / rangeCount;
+      size_t low = range * rangeSize;
+      size_t high = low + rangeSize;
+
+      // A stable radix sort a few bits of the bucket at a time, so that the
+      // counts stay in cache however large the range.
+      std::vector<std::pair<size_t, size_t>> sorted(order.begin() + rangeBegin[range], order.begin() + rangeBegin[range + 1]);
+      std::vector<std::pair<size_t, size_t>> scratch(sorted.size());
+      for (size_t shift = 0; shift < rangeShift; shift += BulkRadixBits) {
+        size_t digitStart[(1 << BulkRadixBits) + 1] = {};
+        for (auto const& entry : sorted)
+          ++digitStart[((targetOf(entry.first) >> shift) & ((1 << BulkRadixBits) - 1)) + 1];
+        for (size_t d = 1; d <= (1 << BulkRadixBits); ++d)
+          digitStart[d] += digitStart[d - 1];
+        for (auto const& entry : sorted)
+          scratch[digitStart[(targetOf(entry.first) >> shift) & ((1 << BulkRadixBits) - 1)]++] = entry;
+        swap(sorted, scratch);
+      }
 
-  while (i != e) {
-    if (*i != *j)
+      size_t nextBucket = low;
+      size_t groupStart = low;
+      size_t groupTarget = NPos;
+      for (size_t n = 0; n < sorted.size(); ++n) {
+        // Buckets are filled in order, but the values come from all over the
+        // input, so fetch them a little ahead.
+        if (n + FindBatchSize < sorted.size())
+          __builtin_prefetch(&*(first + sorted[n + FindBatchSize].second));
+
+        auto const& entry = sorted[n];
+        size_t hash = entry.first;
+        size_t i = entry.second;
+        size_t targetBucket = targetOf(hash);
+        size_t currentBucket = std::max(targetBucket, nextBucket);
+        if (currentBucket >= high) {
+          spilled[range].push_back(entry);
+          continue;
+        }
+
+        if (targetBucket != groupTarget) {
+          groupTarget = targetBucket;
+          groupStart = currentBucket;
+        }
+
+        bool present = false;
+        for (size_t b = groupStart; b < currentBucket && !present; ++b)
+          present = bucketHolds(b, hash, b - targetBucket, keyOf(first[i]));
+        if (present)
+          continue;
+
+        fillBucket(currentBucket, hash, currentBucket - targetBucket, first[i]);
+        ++filled[range];
+        nextBucket = currentBucket + 1;
+      }
+    });
+
+  for (size_t range = 0; range < rangeCount; ++range)
+    m_filledCount += filled[range];
+  for (size_t range = 0; range < rangeCount; ++range) {
+    for (auto const& entry : spilled[range])
+      tryEmplaceHashed(entry.first, keyOf(first[entry.second]), first[entry.second]);
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::operator==(hash_table const& rhs) const {
+  if (size() != rhs.size())
+    return false;
+
+  // Tables with the same contents can still differ in bucket count and in the
+  // order of values that share a target bucket, so look up every value rather
+  // than comparing in iteration order.
+  auto e = rhs.end();
+  for (auto const& value : *this) {
+    auto j = rhs.find(m_getKey(value));
+    if (j == e || !(*j == value))
       return false;
-    ++i;
-    ++j;
   }
 
   return true;
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::operator!=(hash_table const& rhs) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::operator!=(hash_table const& rhs) const {
   return !operator==(rhs);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-constexpr size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::MinCapacity;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::MinCapacity;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::DefaultMaxFillLevel;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::MaxMaxFillLevel;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::MinMaxFillLevel;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::FindBatchSize;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr typename hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::Control hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::EmptyControl;
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-constexpr double hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::MaxFillLevel;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr typename hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::Control hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::EndControl;
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::scan(Bucket* p) -> Bucket* {
-  while (p->isEmpty())
-    ++p;
-  return p;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::MaxControlDistance;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::DefaultMaxProbeDistance;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr double hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::MinGuardFillLevel;
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename BucketPointer>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::scan(BucketPointer& bucket, BucketPointer buckets, uint64_t const* occupied) {
+  size_t index = bucket - buckets;
+  size_t word = index / 64;
+  uint64_t bits = occupied[word] & (~(uint64_t)0 << (index % 64));
+  while (bits == 0)
+    bits = occupied[++word];
+  bucket = buckets + word * 64 + __builtin_ctzll(bits);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::scan(Bucket const* p) -> Bucket const* {
-  while (p->isEmpty())
-    ++p;
-  return p;
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketIterator(size_t bucket) -> iterator {
+  return iterator{m_buckets.data() + bucket, m_buckets.data(), m_occupied.data()};
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::hashBucket(size_t hash) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::hashBucket(size_t hash) const {
   return hash & (m_buckets.size() - 2);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::bucketError(size_t current, size_t target) const {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::targetOf(size_t hash) const {
+  return target_bucket(hash, m_seed, m_buckets.size() - 1);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketError(size_t current, size_t target) const {
   return hashBucket(current - target);
 }
 
-template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator>
-void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::checkCapacity(size_t additionalCapacity) {
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::checkCapacity(size_t additionalCapacity) {
   size_t newSize;
   if (!m_buckets.empty())
     newSize = m_buckets.size() - 1;
   else
     newSize = MinCapacity;
 
-  while ((double)(m_filledCount + additionalCapacity) / (double)newSize > MaxFillLevel)
+  while ((double)(m_filledCount + additionalCapacity) / (double)newSize > m_maxFillLevel) {
+    if (newSize >= maxBucketCount())
+      throw std::length_error("hash table bucket count over max_bucket_count()");
     newSize *= 2;
+  }
 
-  if (newSize == m_buckets.size() - 1)
-    return;
+  if (newSize != m_buckets.size() - 1)
+    rebuild(newSize);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::rebuild(size_t newSize) {
+#if defined(FLAT_HASH_STATS)
+  auto rehashStart = std::chrono::steady_clock::now();
+  struct RehashTimer {
+    ~RehashTimer() {
+      bumpCounter(counters.rehashes, 1);
+      bumpCounter(counters.rehashNanoseconds,
+          std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+    Counters& counters;
+    std::chrono::steady_clock::time_point start;
+  } timer{m_counters, rehashStart};
+#endif
 
-  Buckets oldBuckets;
+  Buckets oldBuckets(m_buckets.get_allocator());
+  Controls oldControl(m_control.get_allocator());
   swap(m_buckets, oldBuckets);
+  swap(m_control, oldControl);
 
   // Leave an extra end entry when allocating buckets, so that iterators are
   // simpler and can simply iterate until they find something that is not an
@@ -538,14 +1740,507 @@ void hash_table<Value, Key, GetKey, Hash, Equals, Allocator>::checkCapacity(size
     newSize *= 2;
     m_buckets.resize(newSize + 1);
   }
-  m_buckets[newSize].setEnd();
+  setEndBucket(m_buckets[newSize]);
 
-  m_filledCount = 0;
+  if (Layout::UseControl) {
+    m_control.resize(newSize + 1, EmptyControl);
+    m_control[newSize] = EndControl;
+  }
+  size_t words = newSize / 64 + 1;
+  m_occupied = Occupancy(words + words / 64 + 1, 0, m_occupied.get_allocator());
+  setOccupied(newSize);
 
-  for (auto& entry : oldBuckets) {
-    if (auto ptr = entry.valuePtr())
-      insert(std::move(*ptr));
+  if (oldBuckets.empty())
+    return;
+
+  // Walk the old table starting just after an empty bucket, so that every run
+  // is visited from its start.  The values of each run then come out ordered
+  // by target bucket, and relocate mostly just appends to the end of a run in
+  // the new table.
+  size_t oldSize = oldBuckets.size() - 1;
+  size_t start = 0;
+  while (bucketFilled(oldBuckets, oldControl, start))
+    ++start;
+
+  for (size_t n = 1; n <= oldSize; ++n) {
+    size_t i = (start + n) & (oldSize - 1);
+    if (bucketFilled(oldBuckets, oldControl, i)) {
+      relocate(storedHash(oldBuckets[i]), std::move(oldBuckets[i].value));
+      if (!Layout::StoreHash)
+        oldBuckets[i].value.~Value();
+    }
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::guardProbeDistance() {
+  size_t bucketCount = m_buckets.size() - 1;
+  if (m_seed == 0) {
+    // Only needs to be unknown to whoever picks the keys, a mix of the table's
+    // address and the time will do.
+    m_seed = mix_hash((size_t)this ^ (size_t)std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+    rebuild(bucketCount);
+    return true;
+  }
+  if (m_filledCount >= bucketCount * MinGuardFillLevel) {
+    rebuild(bucketCount * 2);
+    return true;
+  }
+  return false;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findBucket(K const& key, size_t hash) const {
+  return findBucket(key, hash, UseControl());
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findBucket(K const& key, size_t hash, std::false_type) const {
+  size_t targetBucket = targetOf(hash);
+  size_t currentBucket = targetBucket;
+  while (true) {
+    auto& bucket = m_buckets[currentBucket];
+    if (auto value = bucket.valuePtr()) {
+      if (bucket.hash == hash && m_equals(m_getKey(*value), key))
+        return currentBucket;
+
+      size_t entryError = bucketError(currentBucket, targetOf(bucket.hash));
+      size_t findError = bucketError(currentBucket, targetBucket);
+
+      if (findError > entryError)
+        return NPos;
+
+      currentBucket = hashBucket(currentBucket + 1);
+
+    } else {
+      return NPos;
+    }
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findBucket(K const& key, size_t hash, std::true_type) const {
+  size_t targetBucket = targetOf(hash);
+  size_t distance = 0;
+
+  // A bucket at distance d from the target can only hold the key if its
+  // control word is exactly (print, d + 1), and the key cannot be anywhere
+  // past a bucket whose stored distance is less than d + 1 (which includes
+  // empty buckets).  Whole groups of control words are checked for both
+  // conditions at once, as long as the group does not wrap around the end of
+  // the bucket array and the distances fit in a control word.
+#if defined(__AVX2__) || defined(__SSE2__)
+  size_t bucketCount = m_buckets.size() - 1;
+  Control print = fingerprint(hash);
+#endif
+#if defined(__AVX2__)
+  size_t const GroupSize = 16;
+  __m256i const laneOffsets = _mm256_setr_epi16(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+  __m256i const printWords = _mm256_set1_epi16((short)print);
+  __m256i const distanceMask = _mm256_set1_epi16(0xff);
+  while (distance + GroupSize < MaxControlDistance && targetBucket + distance + GroupSize <= bucketCount) {
+    __m256i controls = _mm256_loadu_si256((__m256i const*)(m_control.data() + targetBucket + distance));
+    __m256i distances = _mm256_add_epi16(_mm256_set1_epi16((short)distance), laneOffsets);
+    uint32_t matches = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(controls, _mm256_or_si256(printWords, distances)));
+    uint32_t stops = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi16(distances, _mm256_and_si256(controls, distanceMask)));
+#elif defined(__SSE2__)
+  size_t const GroupSize = 8;
+  __m128i const laneOffsets = _mm_setr_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  __m128i const printWords = _mm_set1_epi16((short)print);
+  __m128i const distanceMask = _mm_set1_epi16(0xff);
+  while (distance + GroupSize < MaxControlDistance && targetBucket + distance + GroupSize <= bucketCount) {
+    __m128i controls = _mm_loadu_si128((__m128i const*)(m_control.data() + targetBucket + distance));
+    __m128i distances = _mm_add_epi16(_mm_set1_epi16((short)distance), laneOffsets);
+    uint32_t matches = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(controls, _mm_or_si128(printWords, distances)));
+    uint32_t stops = (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi16(_mm_and_si128(controls, distanceMask), distances));
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    // Each lane sets two mask bits, only matches before the first stop count.
+    if (stops)
+      matches &= (stops & (0 - stops)) - 1;
+
+    while (matches) {
+      size_t bucketIndex = targetBucket + distance + (size_t)__builtin_ctz(matches) / 2;
+      if (storedHashMatches(m_buckets[bucketIndex], hash) && m_equals(m_getKey(m_buckets[bucketIndex].value), key))
+        return bucketIndex;
+      matches &= matches - 1;
+      matches &= matches - 1;
+    }
+
+    if (stops)
+      return NPos;
+
+    distance += GroupSize;
+  }
+#endif
+
+  while (true) {
+    size_t bucketIndex = hashBucket(targetBucket + distance);
+    if (!bucketFilled(bucketIndex))
+      return NPos;
+
+    size_t entryDistance = bucketDistance(bucketIndex);
+    if (entryDistance < distance)
+      return NPos;
+
+    if (entryDistance == distance && bucketHolds(bucketIndex, hash, distance, key))
+      return bucketIndex;
+
+    ++distance;
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename K>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketHolds(size_t bucket, size_t hash, size_t distance, K const& key) const {
+  if (Layout::UseControl) {
+    Control control = m_control[bucket];
+    if ((control & 0xff00) != fingerprint(hash))
+      return false;
+    if ((control & 0xff) != MaxControlDistance && (control & 0xff) != distance + 1)
+      return false;
+  }
+  return storedHashMatches(m_buckets[bucket], hash) && m_equals(m_getKey(m_buckets[bucket].value), key);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::eraseBucket(size_t bucket) {
+  size_t currentBucketIndex = bucket;
+
+  emptyBucket(currentBucketIndex);
+  while (true) {
+    size_t nextBucketIndex = hashBucket(currentBucketIndex + 1);
+    if (!bucketFilled(nextBucketIndex) || bucketDistance(nextBucketIndex) == 0)
+      break;
+
+    moveBucket(currentBucketIndex, nextBucketIndex);
+    currentBucketIndex = nextBucketIndex;
+  }
+
+  --m_filledCount;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Predicate>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::eraseBuckets(Predicate&& pred) {
+  if (m_filledCount == 0)
+    return 0;
+
+  // Start from an empty bucket, so that no run wraps around the start.
+  size_t bucketCount = m_buckets.size() - 1;
+  size_t start = 0;
+  while (bucketFilled(start))
+    ++start;
+
+  size_t erased = 0;
+  // The first of the empty buckets just behind the current one, which the
+  // value in it may be shifted back into, or NPos.
+  size_t hole = NPos;
+  for (size_t i = 1; i <= bucketCount; ++i) {
+    size_t bucket = hashBucket(start + i);
+    if (!bucketFilled(bucket)) {
+      hole = NPos;
+    } else if (pred(bucket)) {
+      emptyBucket(bucket);
+      ++erased;
+      if (hole == NPos)
+        hole = bucket;
+    } else if (hole != NPos) {
+      // Values never move back past their target bucket, which ends the hole.
+      size_t shift = std::min(bucketDistance(bucket), bucketError(bucket, hole));
+      if (shift == 0) {
+        hole = NPos;
+      } else {
+        size_t to = hashBucket(bucket - shift);
+        moveBucket(to, bucket);
+        hole = hashBucket(to + 1);
+      }
+    }
+  }
+
+  m_filledCount -= erased;
+  return erased;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::relocate(size_t hash, Args&&... args) {
+  size_t currentBucket = targetOf(hash);
+  size_t distance = 0;
+  while (bucketFilled(currentBucket) && bucketDistance(currentBucket) >= distance) {
+    currentBucket = hashBucket(currentBucket + 1);
+    ++distance;
+  }
+
+  shiftRight(currentBucket);
+  fillBucket(currentBucket, hash, distance, std::forward<Args>(args)...);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::shiftRight(size_t bucket) {
+  size_t emptyBucket = bucket;
+  while (bucketFilled(emptyBucket))
+    emptyBucket = hashBucket(emptyBucket + 1);
+  shiftRight(bucket, emptyBucket);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::shiftRight(size_t bucket, size_t emptyBucket) {
+  while (emptyBucket != bucket) {
+    size_t previousBucket = hashBucket(emptyBucket - 1);
+    moveBucket(emptyBucket, previousBucket);
+    emptyBucket = previousBucket;
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketFilled(Buckets const& buckets, Controls const& control, size_t bucket) {
+  return bucketFilled(buckets, control, bucket, UseControl());
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketFilled(Buckets const&, Controls const& control, size_t bucket, std::true_type) {
+  return control[bucket] != EmptyControl;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketFilled(Buckets const& buckets, Controls const&, size_t bucket, std::false_type) {
+  return buckets[bucket].valuePtr() != nullptr;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketFilled(size_t bucket) const {
+  return bucketFilled(m_buckets, m_control, bucket);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketHash(size_t bucket) const {
+  return storedHash(m_buckets[bucket]);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bucketDistance(size_t bucket) const {
+  if (Layout::UseControl) {
+    size_t distance = m_control[bucket] & 0xff;
+    if (distance != MaxControlDistance)
+      return distance - 1;
+  }
+  return bucketError(bucket, targetOf(bucketHash(bucket)));
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::fillBucket(size_t bucket, size_t hash, size_t distance, Args&&... args) {
+  constructValue(m_buckets[bucket], hash, std::forward<Args>(args)...);
+  if (Layout::UseControl)
+    m_control[bucket] = makeControl(fingerprint(hash), distance);
+  setOccupied(bucket);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::emptyBucket(size_t bucket) {
+  destroyValue(m_buckets[bucket]);
+  if (Layout::UseControl)
+    m_control[bucket] = EmptyControl;
+  clearOccupied(bucket);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::moveBucket(size_t to, size_t from) {
+  size_t distance = 0;
+  if (Layout::UseControl)
+    distance = hashBucket(bucketDistance(from) + to - from);
+
+  moveValue(m_buckets[to], m_buckets[from]);
+
+  if (Layout::UseControl) {
+    m_control[to] = makeControl(m_control[from] & 0xff00, distance);
+    m_control[from] = EmptyControl;
+  }
+  setOccupied(to);
+  clearOccupied(from);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::setOccupied(size_t bucket) {
+  size_t word = bucket / 64;
+  if (m_occupied[word] == 0)
+    m_occupied[occupiedWords() + word / 64] |= (uint64_t)1 << (word % 64);
+  m_occupied[word] |= (uint64_t)1 << (bucket % 64);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::clearOccupied(size_t bucket) {
+  size_t word = bucket / 64;
+  m_occupied[word] &= ~((uint64_t)1 << (bucket % 64));
+  if (m_occupied[word] == 0)
+    m_occupied[occupiedWords() + word / 64] &= ~((uint64_t)1 << (word % 64));
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::occupiedWords() const {
+  return (m_buckets.size() - 1) / 64 + 1;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::storedHash(HashedBucket const& bucket) const {
+  return bucket.hash;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::storedHash(CompactBucket const& bucket) const {
+  return hash_key(m_hash, m_getKey(bucket.value)) | FilledHashBit;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::storedHashMatches(HashedBucket const& bucket, size_t hash) const {
+  return bucket.hash == hash;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::storedHashMatches(CompactBucket const&, size_t) const {
+  return true;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::constructValue(HashedBucket& bucket, size_t hash, Args&&... args) {
+  ValueAllocator alloc(m_buckets.get_allocator());
+  std::allocator_traits<ValueAllocator>::construct(alloc, &bucket.value, std::forward<Args>(args)...);
+  bucket.hash = hash | FilledHashBit;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::constructValue(CompactBucket& bucket, size_t, Args&&... args) {
+  ValueAllocator alloc(m_buckets.get_allocator());
+  std::allocator_traits<ValueAllocator>::construct(alloc, &bucket.value, std::forward<Args>(args)...);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::destroyValue(HashedBucket& bucket) {
+  bucket.setEmpty();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::destroyValue(CompactBucket& bucket) {
+  bucket.value.~Value();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::moveValue(HashedBucket& to, HashedBucket& from) {
+  to.setFilled(from.hash, std::move(from.value));
+  from.setEmpty();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::moveValue(CompactBucket& to, CompactBucket& from) {
+  new (&to.value) Value(std::move(from.value));
+  from.value.~Value();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::setEndBucket(HashedBucket& bucket) {
+  bucket.setEnd();
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::setEndBucket(CompactBucket&) {}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename ValueOf>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::assignBuckets(hash_table const& rhs, ValueOf const& valueOf) {
+  m_filledCount = rhs.m_filledCount;
+  m_seed = rhs.m_seed;
+  m_maxProbeDistance = rhs.m_maxProbeDistance;
+  m_maxFillLevel = rhs.m_maxFillLevel;
+  if (rhs.m_buckets.empty())
+    return;
+
+  m_buckets.resize(rhs.m_buckets.size());
+  setEndBucket(m_buckets.back());
+  m_control.assign(rhs.m_control.begin(), rhs.m_control.end());
+  m_occupied.assign(rhs.m_occupied.begin(), rhs.m_occupied.end());
+  for (size_t i = 0; i + 1 < m_buckets.size(); ++i) {
+    if (rhs.bucketFilled(i))
+      constructValue(m_buckets[i], Layout::StoreHash ? rhs.storedHash(rhs.m_buckets[i]) : 0, valueOf(i));
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::destroyValues() {
+  if (Layout::StoreHash)
+    return;
+
+  forEachFilled([this](size_t bucket) { m_buckets[bucket].value.~Value(); });
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::forEachFilled(Function&& function) const {
+  if (m_occupied.empty())
+    return;
+
+  // Skips the end bucket, whose bit is always set.
+  size_t endBucket = m_buckets.size() - 1;
+  size_t words = occupiedWords();
+  for (size_t summary = words; summary < m_occupied.size(); ++summary) {
+    uint64_t summaryBits = m_occupied[summary];
+    while (summaryBits != 0) {
+      size_t word = (summary - words) * 64 + __builtin_ctzll(summaryBits);
+      summaryBits &= summaryBits - 1;
+      uint64_t bits = m_occupied[word];
+      while (bits != 0) {
+        size_t bucket = word * 64 + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        if (bucket != endBucket)
+          function(bucket);
+      }
+    }
+  }
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::fingerprint(size_t hash) -> Control {
+  // Multiply to fold every bit of the hash into the top byte, so that hashes
+  // which only differ in their low bits (like the identity std::hash for
+  // integers) still get different fingerprints.
+  if (sizeof(size_t) == 8)
+    return (Control)(((uint64_t)hash * 0x9e3779b97f4a7c15ull) >> 56) << 8;
+  else
+    return (Control)(((uint32_t)hash * 0x9e3779b9u) >> 24) << 8;
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::makeControl(Control print, size_t distance) -> Control {
+  return print | (Control)std::min(distance + 1, MaxControlDistance);
+}
+
+
+#if defined(FLAT_HASH_STATS)
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+void hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::bumpCounter(std::atomic<uint64_t>& counter, uint64_t amount) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+template <typename Value, typename Key, typename GetKey, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t hash_table<Value, Key, GetKey, Hash, Equals, Allocator, Layout>::findProbeCount(size_t hash, size_t bucket) const {
+  size_t targetBucket = targetOf(hash);
+  if (bucket != NPos)
+    return bucketError(bucket, targetBucket) + 1;
+
+  // findBucket does not say where a miss stopped, so walk the run again.
+  size_t distance = 0;
+  while (true) {
+    size_t currentBucket = hashBucket(targetBucket + distance);
+    if (!bucketFilled(currentBucket) || bucketDistance(currentBucket) < distance)
+      return distance + 1;
+    ++distance;
   }
 }
+#endif
 
 }
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace flat_hash {
+
+// What backs the large allocations of a huge_page_allocator.
+enum class page_size {
+  // Ordinary pages, with no hint.
+  normal,
+  // Ordinary pages with madvise(MADV_HUGEPAGE), so the kernel backs them with
+  // transparent 2 MB pages where it can.  Needs no setup.
+  transparent,
+  // Pages reserved up front, through /proc/sys/vm/nr_hugepages for 2 MB pages
+  // or the hugepagesz=1G boot option for 1 GB ones, taken with MAP_HUGETLB.
+  // Falls back to transparent when none are free.  huge_1gb only uses 1 GB
+  // pages for allocations of at least 1 GB, and 2 MB ones below that, so that
+  // rounding up to whole pages never takes more than twice the memory asked
+  // for.
+  huge_2mb,
+  huge_1gb
+};
+
+// Which NUMA nodes the pages of a large allocation are placed on.
+enum class numa_placement {
+  // Wherever the thread that first touches them runs.
+  local,
+  // Spread page by page over the nodes, for tables read from every node.
+  interleave,
+  // Only on the nodes given, for tables read from threads pinned there.
+  bind
+};
+
+struct huge_page_options {
+  page_size pages = page_size::transparent;
+  numa_placement placement = numa_placement::local;
+  // The nodes to interleave over or bind to, one bit per node, or 0 for every
+  // online node.
+  uint64_t nodeMask = 0;
+  // Smaller allocations go through std::allocator, so small tables do not each
+  // take a whole huge page.  The smallest huge page there is, see huge_1gb.
+  size_t minSize = 1 << 21;
+};
+
+// An allocator that maps every allocation of at least options.minSize bytes
+// on its own, with the page size and NUMA placement given in options.  Meant
+// for the bucket arrays of tables too large for the TLB to cover with 4 KB
+// pages, where nearly every probe of a find would otherwise miss it, eg
+//
+//   hash_map<Key, Mapped, std::hash<Key>, std::equal_to<Key>, huge_page_allocator<Key>>
+//
+// Huge pages and NUMA placement are Linux only, elsewhere allocations are
+// mapped with ordinary pages.  Both are best effort, memory the kernel will
+// not place as asked is used as it is.  Throws std::bad_alloc if the memory
+// cannot be mapped at all, and std::bad_array_new_length for more than
+// max_size() values.
+template <typename T>
+class huge_page_allocator {
+public:
+  typedef T value_type;
+
+  huge_page_allocator() = default;
+  explicit huge_page_allocator(huge_page_options const& options);
+  template <typename U>
+  huge_page_allocator(huge_page_allocator<U> const& other);
+
+  huge_page_options const& options() const;
+
+  T* allocate(size_t n);
+  void deallocate(T* p, size_t n);
+
+  size_t max_size() const;
+
+  // Equal allocators map allocations of the same size the same way, with the
+  // same page size and NUMA placement, so can free and take over each other's
+  // memory.
+  template <typename U>
+  bool operator==(huge_page_allocator<U> const& rhs) const;
+  template <typename U>
+  bool operator!=(huge_page_allocator<U> const& rhs) const;
+
+private:
+  huge_page_options m_options;
+};
+
+// The online NUMA nodes, one bit per node, or just node 0 if that cannot be
+// found out.
+inline uint64_t online_numa_nodes();
+
+// Maps size bytes as options asks for, see huge_page_allocator.  The mapping
+// is huge_page_mapping_size(size, options) bytes, aligned to its page size.
+inline void* huge_page_map(size_t size, huge_page_options const& options);
+inline void huge_page_unmap(void* p, size_t size, huge_page_options const& options);
+inline size_t huge_page_mapping_size(size_t size, huge_page_options const& options);
+// The size of the pages huge_page_map maps size bytes with.
+inline size_t huge_page_size(size_t size, huge_page_options const& options);
+
+template <typename T>
+huge_page_allocator<T>::huge_page_allocator(huge_page_options const& options)
+  : m_options(options) {}
+
+template <typename T>
+template <typename U>
+huge_page_allocator<T>::huge_page_allocator(huge_page_allocator<U> const& other)
+  : m_options(other.options()) {}
+
+template <typename T>
+huge_page_options const& huge_page_allocator<T>::options() const {
+  return m_options;
+}
+
+template <typename T>
+T* huge_page_allocator<T>::allocate(size_t n) {
+  if (n > max_size())
+    throw std::bad_array_new_length();
+  if (n * sizeof(T) < m_options.minSize)
+    return std::allocator<T>().allocate(n);
+  return (T*)huge_page_map(n * sizeof(T), m_options);
+}
+
+template <typename T>
+void huge_page_allocator<T>::deallocate(T* p, size_t n) {
+  // n is what allocate was given, so no more than max_size().
+  if (n * sizeof(T) < m_options.minSize)
+    std::allocator<T>().deallocate(p, n);
+  else
+    huge_page_unmap(p, n * sizeof(T), m_options);
+}
+
+template <typename T>
+size_t huge_page_allocator<T>::max_size() const {
+  // Leaves room to round the largest allocation up to whole 1 GB pages, and
+  // to align it, without overflowing.
+  return (SIZE_MAX / 2) / sizeof(T);
+}
+
+template <typename T>
+template <typename U>
+bool huge_page_allocator<T>::operator==(huge_page_allocator<U> const& rhs) const {
+  return m_options.pages == rhs.options().pages && m_options.placement == rhs.options().placement
+    && m_options.nodeMask == rhs.options().nodeMask && m_options.minSize == rhs.options().minSize;
+}
+
+template <typename T>
+template <typename U>
+bool huge_page_allocator<T>::operator!=(huge_page_allocator<U> const& rhs) const {
+  return !operator==(rhs);
+}
+
+inline uint64_t online_numa_nodes() {
+  uint64_t nodes = 0;
+  if (std::FILE* file = std::fopen("/sys/devices/system/node/online", "r")) {
+    // A list of node ranges, eg "0-3,6".
+    unsigned first, last;
+    int read;
+    while ((read = std::fscanf(file, "%u-%u", &first, &last)) >= 1) {
+      if (read == 1)
+        last = first;
+      for (unsigned node = first; node <= last && node < 64; ++node)
+        nodes |= (uint64_t)1 << node;
+      if (std::fgetc(file) != ',')
+        break;
+    }
+    std::fclose(file);
+  }
+  return nodes != 0 ? nodes : 1;
+}
+
+inline size_t huge_page_size(size_t size, huge_page_options const& options) {
+  if (options.pages == page_size::normal)
+    return (size_t)sysconf(_SC_PAGESIZE);
+  else if (options.pages == page_size::huge_1gb && size >= ((size_t)1 << 30))
+    return (size_t)1 << 30;
+  else
+    return (size_t)1 << 21;
+}
+
+inline size_t huge_page_mapping_size(size_t size, huge_page_options const& options) {
+  size_t pageSize = huge_page_size(size, options);
+  return (size + pageSize - 1) & ~(pageSize - 1);
+}
+
+inline void* huge_page_map(size_t size, huge_page_options const& options) {
+  size_t mappingSize = huge_page_mapping_size(size, options);
+  void* p = MAP_FAILED;
+
+#if defined(__linux__) && defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  if (options.pages == page_size::huge_2mb || options.pages == page_size::huge_1gb) {
+    int pageShift = huge_page_size(size, options) == ((size_t)1 << 30) ? 30 : 21;
+    p = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+  }
+#endif
+
+  if (p == MAP_FAILED) {
+    if (options.pages == page_size::normal) {
+      p = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+        throw std::bad_alloc();
+    } else {
+      // Transparent huge pages only back 2 MB aligned ranges, so map enough to
+      // align the start and give back the ends.
+      size_t alignment = (size_t)1 << 21;
+      void* region = mmap(nullptr, mappingSize + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (region == MAP_FAILED)
+        throw std::bad_alloc();
+      char* start = (char*)(((uintptr_t)region + alignment - 1) & ~(uintptr_t)(alignment - 1));
+      size_t head = start - (char*)region;
+      if (head != 0)
+        munmap(region, head);
+      munmap(start + mappingSize, alignment - head);
+      p = start;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+      madvise(p, mappingSize, MADV_HUGEPAGE);
+#endif
+    }
+  }
+
+#if defined(__linux__) && defined(SYS_mbind)
+  // Placement has to be set before the pages are first touched.
+  if (options.placement != numa_placement::local) {
+    static constexpr int MpolBind = 2;
+    static constexpr int MpolInterleave = 3;
+    unsigned long nodeMask = options.nodeMask != 0 ? options.nodeMask : online_numa_nodes();
+    syscall(SYS_mbind, p, mappingSize, options.placement == numa_placement::bind ? MpolBind : MpolInterleave,
+        &nodeMask, sizeof(nodeMask) * 8 + 1, 0);
+  }
+#endif
+
+  return p;
+}
+
+inline void huge_page_unmap(void* p, size_t size, huge_page_options const& options) {
+  munmap(p, huge_page_mapping_size(size, options));
+}
+
+}
@@ -0,0 +1,531 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// A hash map that never rehashes everything at once.  The bigger bucket array
+// of the next growth is built a few buckets at a time while the current one
+// fills.  When it is needed the current array is kept alongside it as the old
+// one, and then every mutating operation moves the values of a few old
+// buckets over, so no single insert pays for more than a bounded amount of
+// rehashing or bucket construction.  Lookups check both arrays while a
+// migration is in progress.
+//
+// This trades some average throughput (lookups may probe twice, and inserts
+// build and migrate buckets) for a much lower worst case insert latency on big
+// maps.  It supports the common subset of the
+// hash_map API; as well as on growth, its iterators are invalidated by every
+// insert and erase, since any of them may move values between the arrays.
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>, typename Layout = inline_hash_layout>
+class incremental_hash_map {
+public:
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<key_type const, mapped_type> value_type;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+  typedef Allocator allocator_type;
+  typedef value_type& reference;
+  typedef value_type const& const_reference;
+  typedef value_type* pointer;
+  typedef value_type const* const_pointer;
+
+private:
+  typedef std::pair<key_type, mapped_type> TableValue;
+
+  struct GetKey {
+    key_type const& operator()(TableValue const& value) const;
+  };
+
+  typedef typename std::allocator_traits<Allocator>::template rebind_alloc<TableValue> TableAllocator;
+  typedef hash_table<TableValue, key_type, GetKey, Hash, Equals, TableAllocator, Layout> Table;
+
+public:
+  // Iterates over the current array first, and then over the old one.
+  struct const_iterator {
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename incremental_hash_map::value_type const value_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type* pointer;
+    typedef value_type& reference;
+
+    bool operator==(const_iterator const& rhs) const;
+    bool operator!=(const_iterator const& rhs) const;
+
+    const_iterator& operator++();
+    const_iterator operator++(int);
+
+    value_type& operator*() const;
+    value_type* operator->() const;
+
+    typename Table::const_iterator inner;
+    typename Table::const_iterator innerEnd;
+    Table const* next;
+  };
+
+  struct iterator {
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename incremental_hash_map::value_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type* pointer;
+    typedef value_type& reference;
+
+    bool operator==(iterator const& rhs) const;
+    bool operator!=(iterator const& rhs) const;
+
+    iterator& operator++();
+    iterator operator++(int);
+
+    value_type& operator*() const;
+    value_type* operator->() const;
+
+    operator const_iterator() const;
+
+    typename Table::iterator inner;
+    typename Table::iterator innerEnd;
+    Table* next;
+  };
+
+  incremental_hash_map();
+  explicit incremental_hash_map(size_t bucketCount, hasher const& hash = hasher(),
+      key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
+
+  iterator begin();
+  iterator end();
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  const_iterator cbegin() const;
+  const_iterator cend() const;
+
+  size_t empty() const;
+  size_t size() const;
+  void clear();
+
+  std::pair<iterator, bool> insert(value_type const& value);
+
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type const& key, Args&&... args);
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args);
+
+  size_t erase(key_type const& key);
+
+  mapped_type& at(key_type const& key);
+  mapped_type const& at(key_type const& key) const;
+
+  mapped_type& operator[](key_type const& key);
+  mapped_type& operator[](key_type&& key);
+
+  size_t count(key_type const& key) const;
+  const_iterator find(key_type const& key) const;
+  iterator find(key_type const& key);
+
+  void reserve(size_t capacity);
+
+  // Whether values are still being moved out of an old bucket array.
+  bool migrating() const;
+  // Moves every remaining value out of the old bucket array at once.
+  void finish_migration();
+
+private:
+  // Buckets of the next array built by each insert.  After a growth there are
+  // at least as many inserts before the next one as the old array had values,
+  // more than a third of the buckets of the new array, so building 16 buckets
+  // per insert readies an array twice its size in time.
+  static constexpr size_t PrepareBuckets = 16;
+  // Buckets of the old array looked at by each mutating operation.  A growth
+  // doubles the size, so there are at least as many inserts before the next
+  // growth as there are values to move.  The old array has fewer than 3
+  // buckets per value, and moving a value costs one more step, so looking at 8
+  // per operation always finishes in time.
+  static constexpr size_t MigrateBuckets = 8;
+  static constexpr size_t MinGrowth = 8;
+
+  Table makeTable() const;
+
+  iterator currentIterator(typename Table::iterator i);
+  iterator oldIterator(typename Table::iterator i);
+
+  void migrateStep();
+  // Builds a few more buckets of m_next.
+  void prepareStep();
+  // Moves m_table, which is full, to m_old and starts a migration into
+  // m_next, which has twice its buckets.
+  void grow();
+
+  hasher m_hash;
+  key_equal m_equals;
+  TableAllocator m_alloc;
+
+  // New values only ever go into m_table, m_old only shrinks.
+  Table m_table;
+  Table m_old;
+  // The array m_table will move into on the next growth, while it is built,
+  // and the bucket count it is built with.  This is fixed when a growth
+  // starts, as m_table may still grow on its own in the meantime.
+  Table m_next;
+  size_t m_nextBucketCount;
+  size_t m_migrateBucket;
+  // The number of values m_table has room for without growing on its own, a
+  // growth starts when the map would exceed it.
+  size_t m_growAt;
+};
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::GetKey::operator()(TableValue const& value) const -> key_type const& {
+  return value.first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator==(const_iterator const& rhs) const {
+  return inner == rhs.inner;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator!=(const_iterator const& rhs) const {
+  return inner != rhs.inner;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator++() -> const_iterator& {
+  ++inner;
+  if (inner == innerEnd && next) {
+    inner = next->begin();
+    innerEnd = next->end();
+    next = nullptr;
+  }
+  return *this;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator++(int) -> const_iterator {
+  const_iterator copy(*this);
+  operator++();
+  return copy;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator*() const -> value_type& {
+  return *operator->();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator::operator->() const -> value_type* {
+  return (value_type*)(&*inner);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator==(iterator const& rhs) const {
+  return inner == rhs.inner;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator!=(iterator const& rhs) const {
+  return inner != rhs.inner;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator++() -> iterator& {
+  ++inner;
+  if (inner == innerEnd && next) {
+    inner = next->begin();
+    innerEnd = next->end();
+    next = nullptr;
+  }
+  return *this;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator++(int) -> iterator {
+  iterator copy(*this);
+  operator++();
+  return copy;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator*() const -> value_type& {
+  return *operator->();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator->() const -> value_type* {
+  return (value_type*)(&*inner);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::iterator::operator typename incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::const_iterator() const {
+  return const_iterator{inner, innerEnd, next};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::PrepareBuckets;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::MigrateBuckets;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::MinGrowth;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::incremental_hash_map()
+  : incremental_hash_map(0) {}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::incremental_hash_map(size_t bucketCount, hasher const& hash,
+    key_equal const& equal, allocator_type const& alloc)
+  : m_hash(hash), m_equals(equal), m_alloc(alloc), m_table(makeTable()), m_old(makeTable()), m_next(makeTable()), m_nextBucketCount(MinGrowth), m_migrateBucket(0), m_growAt(0) {
+  if (bucketCount != 0)
+    reserve(bucketCount);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::begin() -> iterator {
+  if (m_table.empty())
+    return iterator{m_old.begin(), m_old.end(), nullptr};
+  return iterator{m_table.begin(), m_table.end(), &m_old};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::end() -> iterator {
+  return iterator{m_old.end(), m_old.end(), nullptr};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::begin() const -> const_iterator {
+  return const_cast<incremental_hash_map*>(this)->begin();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::end() const -> const_iterator {
+  return const_cast<incremental_hash_map*>(this)->end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::cbegin() const -> const_iterator {
+  return begin();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::cend() const -> const_iterator {
+  return end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::empty() const {
+  return m_table.empty() && m_old.empty();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::size() const {
+  return m_table.size() + m_old.size();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::clear() {
+  m_table.clear();
+  m_old = makeTable();
+  m_migrateBucket = 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(value_type const& value) -> std::pair<iterator, bool> {
+  return try_emplace(value.first, value.second);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type const& key, Args&&... args) -> std::pair<iterator, bool> {
+  // key may be the key of a value here, so the map is only changed once it
+  // is known to be missing.
+  size_t hash = m_table.hashKey(key);
+  auto i = m_old.findHashed(key, hash);
+  if (i != m_old.end())
+    return {oldIterator(i), false};
+  auto j = m_table.findHashed(key, hash);
+  if (j != m_table.end())
+    return {currentIterator(j), false};
+
+  migrateStep();
+  prepareStep();
+  if (size() + 1 > m_growAt)
+    grow();
+  auto res = m_table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+  return {currentIterator(res.first), res.second};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type&& key, Args&&... args) -> std::pair<iterator, bool> {
+  // key may be the key of a value here, so the map is only changed once it
+  // is known to be missing.
+  size_t hash = m_table.hashKey(key);
+  auto i = m_old.findHashed(key, hash);
+  if (i != m_old.end())
+    return {oldIterator(i), false};
+  auto j = m_table.findHashed(key, hash);
+  if (j != m_table.end())
+    return {currentIterator(j), false};
+
+  migrateStep();
+  prepareStep();
+  if (size() + 1 > m_growAt)
+    grow();
+  auto res = m_table.tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+  return {currentIterator(res.first), res.second};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(key_type const& key) {
+  // key may be the key of the value erased, so migrate only afterwards.
+  size_t erased = 0;
+  auto i = m_table.find(key);
+  if (i != m_table.end()) {
+    m_table.erase(i);
+    erased = 1;
+  } else {
+    auto j = m_old.find(key);
+    if (j != m_old.end()) {
+      m_old.erase(j);
+      erased = 1;
+    }
+  }
+  migrateStep();
+  return erased;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(key_type const& key) -> mapped_type& {
+  auto i = find(key);
+  if (i == end())
+    throw std::out_of_range("no such key in incremental_hash_map");
+  return i->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::at(key_type const& key) const -> mapped_type const& {
+  auto i = find(key);
+  if (i == end())
+    throw std::out_of_range("no such key in incremental_hash_map");
+  return i->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator[](key_type const& key) -> mapped_type& {
+  return try_emplace(key).first->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::operator[](key_type&& key) -> mapped_type& {
+  return try_emplace(std::move(key)).first->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count(key_type const& key) const {
+  if (find(key) != end())
+    return 1;
+  else
+    return 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key) const -> const_iterator {
+  return const_cast<incremental_hash_map*>(this)->find(key);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key) -> iterator {
+  auto i = m_table.find(key);
+  if (i != m_table.end())
+    return currentIterator(i);
+  return oldIterator(m_old.find(key));
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::reserve(size_t capacity) {
+  if (capacity <= m_growAt)
+    return;
+  finish_migration();
+  m_table.reserve(capacity);
+  m_growAt = m_table.capacity();
+  // Any array being built for the next growth is now too small.
+  m_next = makeTable();
+  m_nextBucketCount = m_table.bucketCount() * 2;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::migrating() const {
+  return !m_old.empty();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::finish_migration() {
+  while (migrating())
+    m_migrateBucket = m_old.migrateTo(m_table, m_migrateBucket, m_old.bucketCount());
+  m_old = makeTable();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::makeTable() const -> Table {
+  return Table(0, GetKey(), m_hash, m_equals, m_alloc);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::currentIterator(typename Table::iterator i) -> iterator {
+  return iterator{i, m_table.end(), &m_old};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::oldIterator(typename Table::iterator i) -> iterator {
+  return iterator{i, m_old.end(), nullptr};
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::migrateStep() {
+  if (!migrating())
+    return;
+  m_migrateBucket = m_old.migrateTo(m_table, m_migrateBucket, MigrateBuckets);
+  if (!migrating())
+    m_old = makeTable();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::prepareStep() {
+  m_next.prepareBuckets(m_nextBucketCount, PrepareBuckets);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void incremental_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::grow() {
+  // The previous migration has always finished and the next array is always
+  // ready by now (see MigrateBuckets and PrepareBuckets), unless m_table grew
+  // on its own, so the rest is only a safety net.
+  finish_migration();
+  if (m_nextBucketCount <= m_table.bucketCount()) {
+    m_next = makeTable();
+    m_nextBucketCount = m_table.bucketCount() * 2;
+  }
+  while (!m_next.prepareBuckets(m_nextBucketCount, m_nextBucketCount))
+    ;
+  m_old = std::move(m_table);
+  m_table = std::move(m_next);
+  m_next = makeTable();
+  m_nextBucketCount = m_table.bucketCount() * 2;
+  m_migrateBucket = m_old.bucketCount();
+  m_growAt = m_table.capacity();
+}
+
+}
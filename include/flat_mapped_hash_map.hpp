@@ -0,0 +1,419 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// The file written by write_mapped_hash_map and read by mapped_hash_map: this
+// header, then the stored hash of every bucket as a uint64_t, zero for empty
+// buckets, plus one end bucket, then the value of every bucket as a
+// std::pair<Key, Mapped>, zero bytes for empty buckets.  Both arrays start at
+// the offsets given here.  Everything is in the byte order and struct layout
+// of the machine that wrote it, which the header records enough of to refuse
+// files from elsewhere.
+struct mapped_file_header {
+  static constexpr char const* Magic = "flathash";
+  static constexpr uint32_t CurrentVersion = 2;
+  static constexpr uint32_t ByteOrderMark = 0x01020304;
+  static constexpr uint64_t EndHash = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t hashBits;
+  uint32_t valueSize;
+  uint32_t valueAlign;
+  uint32_t keySize;
+  uint64_t bucketCount;
+  uint64_t size;
+  uint64_t hashesOffset;
+  uint64_t valuesOffset;
+  uint64_t fileSize;
+  // The seed of a reseeded table, see target_bucket.
+  uint64_t bucketSeed;
+};
+
+// Writes the buckets of a hash_map, exactly as they are, to the file at path.
+// Key and Mapped must be trivially copyable.  Throws std::runtime_error if the
+// file cannot be written.
+template <typename Map>
+void write_mapped_hash_map(Map const& map, std::string const& path);
+
+// A read-only view of a file written by write_mapped_hash_map, which maps the
+// file into memory and looks keys up in it directly, with the same robin hood
+// probing as hash_table, so opening it costs nothing however large the table
+// is, and processes that map the same file share its pages.
+//
+// Hash and Equals must behave exactly as those of the map that was written,
+// which is checked on opening only by re-hashing one key.  Only available on
+// POSIX systems.
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>>
+class mapped_hash_map {
+public:
+  static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Mapped>::value,
+      "mapped_hash_map needs trivially copyable keys and values");
+
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<key_type const, mapped_type> value_type;
+  typedef size_t size_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+
+  struct const_iterator {
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename mapped_hash_map::value_type const value_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type* pointer;
+    typedef value_type& reference;
+
+    bool operator==(const_iterator const& rhs) const;
+    bool operator!=(const_iterator const& rhs) const;
+
+    const_iterator& operator++();
+    const_iterator operator++(int);
+
+    value_type& operator*() const;
+    value_type* operator->() const;
+
+    uint64_t const* hash;
+    std::pair<Key, Mapped> const* value;
+  };
+
+  typedef const_iterator iterator;
+
+  // Throws std::runtime_error if the file cannot be mapped or was not written
+  // by write_mapped_hash_map for this key and value type on this platform.
+  explicit mapped_hash_map(std::string const& path, hasher const& hash = hasher(), key_equal const& equal = key_equal());
+  ~mapped_hash_map();
+
+  mapped_hash_map(mapped_hash_map&& other);
+  mapped_hash_map& operator=(mapped_hash_map&& other);
+
+  mapped_hash_map(mapped_hash_map const&) = delete;
+  mapped_hash_map& operator=(mapped_hash_map const&) = delete;
+
+  const_iterator begin() const;
+  const_iterator end() const;
+  const_iterator cbegin() const;
+  const_iterator cend() const;
+
+  bool empty() const;
+  size_t size() const;
+  size_t bucket_count() const;
+
+  mapped_type const& at(key_type const& key) const;
+  size_t count(key_type const& key) const;
+  const_iterator find(key_type const& key) const;
+
+private:
+  typedef std::pair<key_type, mapped_type> FileValue;
+
+  static size_t const FilledHashBit = (size_t)1 << (sizeof(size_t) * 8 - 1);
+
+  void unmap();
+  const_iterator bucketIterator(size_t bucket) const;
+
+  hasher m_hash;
+  key_equal m_equals;
+
+  void* m_mapping;
+  size_t m_mappingSize;
+  mapped_file_header const* m_header;
+  uint64_t const* m_hashes;
+  FileValue const* m_values;
+};
+
+template <typename Map>
+void write_mapped_hash_map(Map const& map, std::string const& path) {
+  typedef std::pair<typename Map::key_type, typename Map::mapped_type> FileValue;
+  static_assert(std::is_trivially_copyable<typename Map::key_type>::value && std::is_trivially_copyable<typename Map::mapped_type>::value,
+      "write_mapped_hash_map needs trivially copyable keys and values");
+
+  std::vector<uint64_t> hashes;
+  map.for_each_bucket([&hashes](size_t hash, typename Map::value_type const*) {
+      hashes.push_back(hash);
+    });
+  hashes.push_back((uint64_t)mapped_file_header::EndHash);
+
+  auto alignUp = [](uint64_t offset, uint64_t align) {
+    return (offset + align - 1) / align * align;
+  };
+
+  mapped_file_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, mapped_file_header::Magic, sizeof(header.magic));
+  header.version = mapped_file_header::CurrentVersion;
+  header.byteOrder = mapped_file_header::ByteOrderMark;
+  header.hashBits = sizeof(size_t) * 8;
+  header.valueSize = sizeof(FileValue);
+  header.valueAlign = alignof(FileValue);
+  header.keySize = sizeof(typename Map::key_type);
+  header.bucketCount = hashes.size() - 1;
+  header.size = map.size();
+  header.hashesOffset = alignUp(sizeof(header), alignof(uint64_t));
+  header.valuesOffset = alignUp(header.hashesOffset + hashes.size() * sizeof(uint64_t), alignof(FileValue));
+  header.fileSize = header.valuesOffset + header.bucketCount * sizeof(FileValue);
+  header.bucketSeed = map.bucket_seed();
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  auto pad = [&file](uint64_t offset) {
+    while ((uint64_t)file.tellp() < offset)
+      file.put(0);
+  };
+
+  file.write((char const*)&header, sizeof(header));
+  pad(header.hashesOffset);
+  file.write((char const*)hashes.data(), hashes.size() * sizeof(uint64_t));
+  pad(header.valuesOffset);
+
+  char empty[sizeof(FileValue)] = {};
+  map.for_each_bucket([&file, &empty](size_t, typename Map::value_type const* value) {
+      if (value)
+        file.write((char const*)value, sizeof(FileValue));
+      else
+        file.write(empty, sizeof(FileValue));
+    });
+
+  file.close();
+  if (!file)
+    throw std::runtime_error("could not write mapped hash map to " + path);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+bool mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator==(const_iterator const& rhs) const {
+  return hash == rhs.hash;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+bool mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator!=(const_iterator const& rhs) const {
+  return hash != rhs.hash;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator++() -> const_iterator& {
+  // The end bucket's hash is never zero, so this stops there.
+  do {
+    ++hash;
+    ++value;
+  } while (*hash == 0);
+  return *this;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator++(int) -> const_iterator {
+  const_iterator copy(*this);
+  operator++();
+  return copy;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator*() const -> value_type& {
+  return *operator->();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::const_iterator::operator->() const -> value_type* {
+  return (value_type*)value;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+mapped_hash_map<Key, Mapped, Hash, Equals>::mapped_hash_map(std::string const& path, hasher const& hash, key_equal const& equal)
+  : m_hash(hash), m_equals(equal), m_mapping(nullptr), m_mappingSize(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open mapped hash map " + path);
+
+  struct stat status;
+  if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(mapped_file_header)) {
+    close(fd);
+    throw std::runtime_error("mapped hash map " + path + " is truncated");
+  }
+
+  m_mappingSize = status.st_size;
+  m_mapping = mmap(nullptr, m_mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m_mapping == MAP_FAILED) {
+    m_mapping = nullptr;
+    throw std::runtime_error("could not map mapped hash map " + path);
+  }
+
+  m_header = (mapped_file_header const*)m_mapping;
+  m_hashes = nullptr;
+  m_values = nullptr;
+
+  // Every field is checked before any pointer is formed from it.  Once the
+  // bucket count and both offsets are known to be within the file size, which
+  // is far below 2^64, none of the sums below can overflow.
+  mapped_file_header const& header = *m_header;
+  bool valid = std::memcmp(header.magic, mapped_file_header::Magic, sizeof(header.magic)) == 0
+    && header.version == mapped_file_header::CurrentVersion
+    && header.byteOrder == mapped_file_header::ByteOrderMark
+    && header.hashBits == sizeof(size_t) * 8
+    && header.valueSize == sizeof(FileValue)
+    && header.valueAlign == alignof(FileValue)
+    && header.keySize == sizeof(Key)
+    && header.fileSize == m_mappingSize
+    && (header.bucketCount & (header.bucketCount - 1)) == 0
+    && header.bucketCount <= header.fileSize / sizeof(FileValue)
+    && header.bucketCount < header.fileSize / sizeof(uint64_t)
+    && header.size <= header.bucketCount
+    && header.hashesOffset >= sizeof(mapped_file_header)
+    && header.hashesOffset < header.fileSize
+    && header.hashesOffset % alignof(uint64_t) == 0
+    && header.valuesOffset <= header.fileSize
+    && header.valuesOffset % alignof(FileValue) == 0
+    && header.hashesOffset + (header.bucketCount + 1) * sizeof(uint64_t) <= header.valuesOffset
+    && header.valuesOffset + header.bucketCount * sizeof(FileValue) == header.fileSize;
+
+  if (valid) {
+    m_hashes = (uint64_t const*)((char const*)m_mapping + header.hashesOffset);
+    m_values = (FileValue const*)((char const*)m_mapping + header.valuesOffset);
+    valid = m_hashes[header.bucketCount] == mapped_file_header::EndHash;
+  }
+
+  // The first filled bucket must hold the hash this Hash gives its key.
+  for (size_t bucket = 0; valid && bucket < header.bucketCount; ++bucket) {
+    if (m_hashes[bucket] != 0) {
+      valid = m_hashes[bucket] == (hash_key(m_hash, m_values[bucket].first) | FilledHashBit);
+      break;
+    }
+  }
+
+  if (!valid) {
+    unmap();
+    throw std::runtime_error("mapped hash map " + path + " was not written for this map type");
+  }
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+mapped_hash_map<Key, Mapped, Hash, Equals>::~mapped_hash_map() {
+  unmap();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+mapped_hash_map<Key, Mapped, Hash, Equals>::mapped_hash_map(mapped_hash_map&& other)
+  : m_hash(std::move(other.m_hash)), m_equals(std::move(other.m_equals)), m_mapping(other.m_mapping),
+    m_mappingSize(other.m_mappingSize), m_header(other.m_header), m_hashes(other.m_hashes), m_values(other.m_values) {
+  other.m_mapping = nullptr;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::operator=(mapped_hash_map&& other) -> mapped_hash_map& {
+  if (this != &other) {
+    unmap();
+    m_hash = std::move(other.m_hash);
+    m_equals = std::move(other.m_equals);
+    m_mapping = other.m_mapping;
+    m_mappingSize = other.m_mappingSize;
+    m_header = other.m_header;
+    m_hashes = other.m_hashes;
+    m_values = other.m_values;
+    other.m_mapping = nullptr;
+  }
+  return *this;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::begin() const -> const_iterator {
+  const_iterator i = bucketIterator(0);
+  if (*i.hash == 0)
+    ++i;
+  return i;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::end() const -> const_iterator {
+  return bucketIterator(m_header->bucketCount);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::cbegin() const -> const_iterator {
+  return begin();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::cend() const -> const_iterator {
+  return end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+bool mapped_hash_map<Key, Mapped, Hash, Equals>::empty() const {
+  return m_header->size == 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+size_t mapped_hash_map<Key, Mapped, Hash, Equals>::size() const {
+  return m_header->size;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+size_t mapped_hash_map<Key, Mapped, Hash, Equals>::bucket_count() const {
+  return m_header->bucketCount;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::at(key_type const& key) const -> mapped_type const& {
+  auto i = find(key);
+  if (i == end())
+    throw std::out_of_range("no such key in mapped_hash_map");
+  return i->second;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+size_t mapped_hash_map<Key, Mapped, Hash, Equals>::count(key_type const& key) const {
+  return find(key) != end() ? 1 : 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::find(key_type const& key) const -> const_iterator {
+  size_t bucketCount = m_header->bucketCount;
+  if (bucketCount == 0)
+    return end();
+
+  // The probe of hash_table's inline_hash_layout: stop at an empty bucket or at
+  // one whose value is closer to its target bucket than the key would be.
+  size_t seed = m_header->bucketSeed;
+  size_t hash = hash_key(m_hash, key) | FilledHashBit;
+  size_t bucket = target_bucket(hash, seed, bucketCount);
+  for (size_t distance = 0; m_hashes[bucket] != 0; ++distance) {
+    size_t bucketHash = m_hashes[bucket];
+    if (bucketHash == hash && m_equals(m_values[bucket].first, key))
+      return bucketIterator(bucket);
+    if (((bucket - target_bucket(bucketHash, seed, bucketCount)) & (bucketCount - 1)) < distance)
+      break;
+    bucket = (bucket + 1) & (bucketCount - 1);
+  }
+  return end();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+void mapped_hash_map<Key, Mapped, Hash, Equals>::unmap() {
+  if (m_mapping)
+    munmap(m_mapping, m_mappingSize);
+  m_mapping = nullptr;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals>
+auto mapped_hash_map<Key, Mapped, Hash, Equals>::bucketIterator(size_t bucket) const -> const_iterator {
+  return const_iterator{m_hashes + bucket, m_values + bucket};
+}
+
+}
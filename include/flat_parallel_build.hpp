@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace flat_hash {
+
+// Runs task(0) ... task(count - 1) each on its own thread, the first on the
+// calling thread, and returns once all of them are done.  The task runner
+// parallel_insert uses unless given another, eg one backed by a thread pool.
+struct thread_runner {
+  template <typename Task>
+  void operator()(size_t count, Task const& task) const;
+};
+
+// Inserts [first, last) into an empty hash_map or hash_set using threadCount
+// threads, or one per core when zero.  The result is the same as that of
+// insert(first, last).  Building anything that includes this needs -pthread.
+template <typename Container, typename RandomIt>
+void parallel_insert(Container& container, RandomIt first, RandomIt last, size_t threadCount = 0);
+
+template <typename Task>
+void thread_runner::operator()(size_t count, Task const& task) const {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < count; ++i)
+    threads.emplace_back([&task, i]() { task(i); });
+  if (count > 0)
+    task(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+template <typename Container, typename RandomIt>
+void parallel_insert(Container& container, RandomIt first, RandomIt last, size_t threadCount) {
+  if (threadCount == 0)
+    threadCount = std::thread::hardware_concurrency();
+  container.insert_parallel(first, last, threadCount, thread_runner());
+}
+
+}
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// A hash map for tables that are read by many threads and written rarely.
+// Lookups take no lock and write to no shared cache line: they probe the table
+// optimistically and then check a sequence counter, which writers bump before
+// and after every change, to see whether a writer got in the way, retrying if
+// so.  Writers are serialized by a mutex.
+//
+// A lookup may read a value while it is being overwritten, which is only
+// harmless when it cannot crash anything: Key and Mapped must be trivially
+// copyable, and Hash and Equals must be fine with being given a torn key (the
+// result is discarded).  When the table grows, the writer builds a bigger copy
+// and publishes it, and the old one is freed once no lookup can still be
+// reading it, so lookups never see a bucket array being reallocated.  For the
+// same reason, the table does not reseed or grow on long probes (see
+// hash_table::maxProbeDistance).
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename Equals = std::equal_to<Key>, typename Allocator = std::allocator<Key>, typename Layout = inline_hash_layout>
+class read_mostly_hash_map {
+public:
+  static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Mapped>::value,
+      "read_mostly_hash_map needs trivially copyable keys and values");
+
+  typedef Key key_type;
+  typedef Mapped mapped_type;
+  typedef std::pair<key_type const, mapped_type> value_type;
+  typedef size_t size_type;
+  typedef Hash hasher;
+  typedef Equals key_equal;
+  typedef Allocator allocator_type;
+
+  explicit read_mostly_hash_map(size_t bucketCount = 0, hasher const& hash = hasher(),
+      key_equal const& equal = key_equal(), allocator_type const& alloc = allocator_type());
+  // No lookup may be running on the map any more.
+  ~read_mostly_hash_map();
+
+  read_mostly_hash_map(read_mostly_hash_map const&) = delete;
+  read_mostly_hash_map& operator=(read_mostly_hash_map const&) = delete;
+
+  // Lock free, may be called from any number of threads at once, and at the
+  // same time as any of the writing methods.  Leaves result as it was if key
+  // is missing.
+  bool find(key_type const& key, mapped_type& result) const;
+  size_t count(key_type const& key) const;
+  bool empty() const;
+  size_t size() const;
+
+  // Writing methods, these are serialized with each other.
+  bool insert(value_type const& value);
+  template <typename... Args>
+  bool try_emplace(key_type const& key, Args&&... args);
+  template <typename M>
+  bool insert_or_assign(key_type const& key, M&& obj);
+  size_t erase(key_type const& key);
+  void clear();
+  void reserve(size_t capacity);
+
+  // Calls function with every value.  Holds the writer lock, so lookups carry
+  // on, but writers wait.
+  template <typename Function>
+  void for_each(Function&& function) const;
+
+private:
+  typedef std::pair<key_type, mapped_type> TableValue;
+
+  struct GetKey {
+    key_type const& operator()(TableValue const& value) const;
+  };
+
+  typedef hash_table<TableValue, key_type, GetKey, Hash, Equals, typename std::allocator_traits<Allocator>::template rebind_alloc<TableValue>, Layout> Table;
+
+  // Each lookup counts itself in one of these while it may be touching a
+  // table, picked per thread, so that lookups from different threads rarely
+  // write to the same cache line.  A retired table can be freed once every
+  // slot has been seen at zero after it was unpublished.
+  static constexpr size_t ReaderSlotBits = 6;
+  static constexpr size_t ReaderSlots = (size_t)1 << ReaderSlotBits;
+
+  struct ReaderSlot {
+    std::atomic<size_t> readers;
+    char padding[64 - sizeof(std::atomic<size_t>)];
+  };
+
+  static size_t readerSlot();
+
+  // Makes sure the current table can take one more value without growing in
+  // place, replacing it with a bigger copy if not.
+  void makeRoom(size_t capacity);
+  void beginWrite();
+  void endWrite();
+  void reclaim();
+
+  hasher m_hash;
+
+  // Written only by writers, so readers can share these cache lines.
+  std::atomic<size_t> m_sequence;
+  std::atomic<Table*> m_table;
+
+  ReaderSlot m_readers[ReaderSlots];
+
+  mutable std::mutex m_writeMutex;
+  std::vector<Table*> m_retired;
+};
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::ReaderSlotBits;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+constexpr size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::ReaderSlots;
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+auto read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::GetKey::operator()(TableValue const& value) const -> key_type const& {
+  return value.first;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::read_mostly_hash_map(size_t bucketCount,
+    hasher const& hash, key_equal const& equal, allocator_type const& alloc)
+  : m_hash(hash), m_sequence(0), m_table(new Table(bucketCount, GetKey(), hash, equal, alloc)) {
+  // The table must never reallocate its buckets under lookups, so it cannot
+  // reseed or grow on long probes.
+  m_table.load()->setMaxProbeDistance((size_t)-1);
+  for (auto& slot : m_readers)
+    slot.readers.store(0, std::memory_order_relaxed);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::~read_mostly_hash_map() {
+  delete m_table.load();
+  for (Table* table : m_retired)
+    delete table;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::find(key_type const& key, mapped_type& result) const {
+  size_t hash = hash_key(m_hash, key);
+  auto& slot = const_cast<ReaderSlot&>(m_readers[readerSlot()]);
+  slot.readers.fetch_add(1);
+
+  // Read into a copy, the value may be torn until the sequence is checked, and
+  // result must be left alone if a retry then misses the key.
+  mapped_type value;
+  bool found;
+  while (true) {
+    size_t sequence = m_sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    Table const* table = m_table.load();
+    auto i = table->findHashed(key, hash);
+    found = i != table->end();
+    if (found)
+      value = i->second;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_sequence.load(std::memory_order_relaxed) == sequence)
+      break;
+  }
+
+  slot.readers.fetch_sub(1, std::memory_order_release);
+  if (found)
+    result = value;
+  return found;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::count(key_type const& key) const {
+  mapped_type result;
+  return find(key, result) ? 1 : 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::empty() const {
+  return size() == 0;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::size() const {
+  auto& slot = const_cast<ReaderSlot&>(m_readers[readerSlot()]);
+  slot.readers.fetch_add(1);
+  size_t size = m_table.load()->size();
+  slot.readers.fetch_sub(1, std::memory_order_release);
+  return size;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+bool read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert(value_type const& value) {
+  return try_emplace(value.first, value.second);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename... Args>
+bool read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::try_emplace(key_type const& key, Args&&... args) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  Table* table = m_table.load(std::memory_order_relaxed);
+  size_t hash = hash_key(m_hash, key);
+  if (table->findHashed(key, hash) != table->end())
+    return false;
+
+  makeRoom(table->size() + 1);
+  table = m_table.load(std::memory_order_relaxed);
+  beginWrite();
+  table->tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+  endWrite();
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename M>
+bool read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::insert_or_assign(key_type const& key, M&& obj) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  Table* table = m_table.load(std::memory_order_relaxed);
+  size_t hash = hash_key(m_hash, key);
+  auto i = table->findHashed(key, hash);
+  if (i != table->end()) {
+    beginWrite();
+    i->second = std::forward<M>(obj);
+    endWrite();
+    return false;
+  }
+
+  makeRoom(table->size() + 1);
+  table = m_table.load(std::memory_order_relaxed);
+  beginWrite();
+  table->tryEmplaceHashed(hash, key, std::piecewise_construct,
+      std::forward_as_tuple(key), std::forward_as_tuple(std::forward<M>(obj)));
+  endWrite();
+  return true;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::erase(key_type const& key) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  Table* table = m_table.load(std::memory_order_relaxed);
+  auto i = table->find(key);
+  if (i == table->end())
+    return 0;
+
+  beginWrite();
+  table->erase(i);
+  endWrite();
+  return 1;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::clear() {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  beginWrite();
+  m_table.load(std::memory_order_relaxed)->clear();
+  endWrite();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::reserve(size_t capacity) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  makeRoom(capacity);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+template <typename Function>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::for_each(Function&& function) const {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  for (auto const& value : *m_table.load(std::memory_order_relaxed))
+    function((value_type const&)value);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+size_t read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::readerSlot() {
+  // Some standard libraries hash a thread id to the thread's aligned address
+  // as it is, so mix it and take the top bits.
+  static thread_local size_t const slot =
+      mix_hash(std::hash<std::thread::id>()(std::this_thread::get_id())) >> (sizeof(size_t) * 8 - ReaderSlotBits);
+  return slot;
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::makeRoom(size_t capacity) {
+  Table* table = m_table.load(std::memory_order_relaxed);
+  if (capacity <= table->capacity())
+    return;
+
+  Table* grown = new Table(*table);
+  grown->reserve(std::max(capacity, table->capacity() * 2));
+  // Lookups that already loaded the old table finish on it, which is fine as
+  // it is never changed again.
+  m_table.store(grown);
+  m_retired.push_back(table);
+  reclaim();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::beginWrite() {
+  m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::endWrite() {
+  m_sequence.store(m_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  reclaim();
+}
+
+template <typename Key, typename Mapped, typename Hash, typename Equals, typename Allocator, typename Layout>
+void read_mostly_hash_map<Key, Mapped, Hash, Equals, Allocator, Layout>::reclaim() {
+  if (m_retired.empty())
+    return;
+
+  // A lookup counts itself before loading the table pointer, so one that could
+  // have loaded a retired table is still counted here until it is done.  If a
+  // slot stays busy the retired tables just wait for a later write.
+  for (auto const& slot : m_readers) {
+    if (slot.readers.load() != 0)
+      return;
+  }
+
+  for (Table* table : m_retired)
+    delete table;
+  m_retired.clear();
+}
+
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "flat_hash_table.hpp"
+
+namespace flat_hash {
+
+// How save and load write and read a key or mapped value.  Specialize this for
+// your own types, with the same two static members.  Provided for trivially
+// copyable types, which are written as their bytes, and for std::basic_string,
+// std::vector and std::pair of supported types.
+template <typename T, typename Enable = void>
+struct serializer;
+
+template <typename T>
+struct serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+  static void write(std::ostream& out, T const& value);
+  static T read(std::istream& in);
+};
+
+template <typename Char, typename Traits, typename Allocator>
+struct serializer<std::basic_string<Char, Traits, Allocator>> {
+  static void write(std::ostream& out, std::basic_string<Char, Traits, Allocator> const& value);
+  static std::basic_string<Char, Traits, Allocator> read(std::istream& in);
+};
+
+template <typename T, typename Allocator>
+struct serializer<std::vector<T, Allocator>> {
+  static void write(std::ostream& out, std::vector<T, Allocator> const& value);
+  static std::vector<T, Allocator> read(std::istream& in);
+};
+
+template <typename First, typename Second>
+struct serializer<std::pair<First, Second>, typename std::enable_if<!std::is_trivially_copyable<std::pair<First, Second>>::value>::type> {
+  static void write(std::ostream& out, std::pair<First, Second> const& value);
+  static std::pair<First, Second> read(std::istream& in);
+};
+
+// Writes a hash_map or hash_set to out: a short header, then every value along
+// with the stored hash of its key.  Throws std::runtime_error if out fails.
+template <typename Container>
+void save(Container const& container, std::ostream& out);
+
+// Replaces the contents of a hash_map or hash_set with what save wrote to in.
+// The table is sized once up front, and values are placed using the saved
+// hashes, without hashing any keys and only comparing keys of equal hashes, so
+// the hasher must be the one that was saved with, which is checked for only
+// one key.  Sizes in the data are not trusted with more than MaxTrustedBytes
+// of memory before the data they describe has been read, except that the
+// table is sized for every value when in is seekable and has enough bytes
+// left to hold them, so only a stream that cannot seek, eg a pipe, may have
+// the table grow while loading.  Throws std::runtime_error if in is
+// truncated, holds a key twice or was saved differently, leaving the
+// container with whatever was read so far.
+template <typename Container>
+void load(Container& container, std::istream& in);
+
+struct serialization_header {
+  static constexpr char const* Magic = "flatsave";
+  static constexpr uint32_t CurrentVersion = 1;
+  static constexpr uint32_t ByteOrderMark = 0x01020304;
+  // The most load reserves or reads in one go on the word of a size read from
+  // the stream.
+  static constexpr size_t MaxTrustedBytes = 1 << 20;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t hashBits;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+constexpr size_t serialization_header::MaxTrustedBytes;
+
+template <typename T>
+void serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>::write(std::ostream& out, T const& value) {
+  out.write((char const*)&value, sizeof(T));
+}
+
+template <typename T>
+T serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>::read(std::istream& in) {
+  T value;
+  if (!in.read((char*)&value, sizeof(T)))
+    throw std::runtime_error("truncated hash table data");
+  return value;
+}
+
+template <typename Char, typename Traits, typename Allocator>
+void serializer<std::basic_string<Char, Traits, Allocator>>::write(std::ostream& out, std::basic_string<Char, Traits, Allocator> const& value) {
+  serializer<uint64_t>::write(out, value.size());
+  out.write((char const*)value.data(), value.size() * sizeof(Char));
+}
+
+template <typename Char, typename Traits, typename Allocator>
+auto serializer<std::basic_string<Char, Traits, Allocator>>::read(std::istream& in) -> std::basic_string<Char, Traits, Allocator> {
+  uint64_t size = serializer<uint64_t>::read(in);
+  std::basic_string<Char, Traits, Allocator> value;
+  while (value.size() < size) {
+    size_t offset = value.size();
+    size_t chunk = std::min<uint64_t>(size - offset, serialization_header::MaxTrustedBytes / sizeof(Char));
+    value.resize(offset + chunk);
+    if (!in.read((char*)&value[offset], chunk * sizeof(Char)))
+      throw std::runtime_error("truncated hash table data");
+  }
+  return value;
+}
+
+template <typename T, typename Allocator>
+void serializer<std::vector<T, Allocator>>::write(std::ostream& out, std::vector<T, Allocator> const& value) {
+  serializer<uint64_t>::write(out, value.size());
+  for (auto const& element : value)
+    serializer<T>::write(out, element);
+}
+
+template <typename T, typename Allocator>
+auto serializer<std::vector<T, Allocator>>::read(std::istream& in) -> std::vector<T, Allocator> {
+  uint64_t size = serializer<uint64_t>::read(in);
+  std::vector<T, Allocator> value;
+  value.reserve(std::min<uint64_t>(size, serialization_header::MaxTrustedBytes / sizeof(T)));
+  for (uint64_t i = 0; i < size; ++i)
+    value.push_back(serializer<T>::read(in));
+  return value;
+}
+
+template <typename First, typename Second>
+void serializer<std::pair<First, Second>, typename std::enable_if<!std::is_trivially_copyable<std::pair<First, Second>>::value>::type>::write(
+    std::ostream& out, std::pair<First, Second> const& value) {
+  serializer<typename std::remove_const<First>::type>::write(out, value.first);
+  serializer<Second>::write(out, value.second);
+}
+
+template <typename First, typename Second>
+auto serializer<std::pair<First, Second>, typename std::enable_if<!std::is_trivially_copyable<std::pair<First, Second>>::value>::type>::read(
+    std::istream& in) -> std::pair<First, Second> {
+  auto first = serializer<typename std::remove_const<First>::type>::read(in);
+  return std::pair<First, Second>(std::move(first), serializer<Second>::read(in));
+}
+
+// hash_map values are written as key then mapped value, and are rebuilt from
+// the two, hash_set values are just keys.
+template <typename Container, typename = void>
+struct serialized_value {
+  typedef typename Container::key_type key_type;
+
+  static void write(std::ostream& out, key_type const& value) {
+    serializer<key_type>::write(out, value);
+  }
+
+  static key_type const& key(key_type const& value) {
+    return value;
+  }
+
+  static void read(Container& container, std::istream& in, size_t hash) {
+    if (!container.emplace_unique_hashed(hash, serializer<key_type>::read(in)))
+      throw std::runtime_error("hash table data holds a key twice");
+  }
+};
+
+template <typename Container>
+struct serialized_value<Container, typename make_void<typename Container::mapped_type>::type> {
+  typedef typename Container::key_type key_type;
+  typedef typename Container::mapped_type mapped_type;
+
+  static void write(std::ostream& out, typename Container::value_type const& value) {
+    serializer<key_type>::write(out, value.first);
+    serializer<mapped_type>::write(out, value.second);
+  }
+
+  static key_type const& key(typename Container::value_type const& value) {
+    return value.first;
+  }
+
+  static void read(Container& container, std::istream& in, size_t hash) {
+    key_type key = serializer<key_type>::read(in);
+    if (!container.emplace_unique_hashed(hash, std::move(key), serializer<mapped_type>::read(in)))
+      throw std::runtime_error("hash table data holds a key twice");
+  }
+};
+
+template <typename Container>
+void save(Container const& container, std::ostream& out) {
+  serialization_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, serialization_header::Magic, sizeof(header.magic));
+  header.version = serialization_header::CurrentVersion;
+  header.byteOrder = serialization_header::ByteOrderMark;
+  header.hashBits = sizeof(size_t) * 8;
+  header.size = container.size();
+  serializer<serialization_header>::write(out, header);
+
+  container.for_each_bucket([&out](size_t hash, typename Container::value_type const* value) {
+      if (value) {
+        serializer<uint64_t>::write(out, hash);
+        serialized_value<Container>::write(out, *value);
+      }
+    });
+
+  if (!out)
+    throw std::runtime_error("could not write hash table data");
+}
+
+// The bytes left to read in in, or zero if in cannot seek.
+inline uint64_t serialized_bytes_left(std::istream& in) {
+  // Through the buffer, so that a stream that cannot seek is left as it was.
+  std::streambuf* buffer = in.rdbuf();
+  std::streampos position = buffer->pubseekoff(0, std::ios::cur, std::ios::in);
+  if (position == std::streampos(-1))
+    return 0;
+  std::streampos end = buffer->pubseekoff(0, std::ios::end, std::ios::in);
+  buffer->pubseekpos(position, std::ios::in);
+  if (end == std::streampos(-1) || end < position)
+    return 0;
+  return (uint64_t)(end - position);
+}
+
+template <typename Container>
+void load(Container& container, std::istream& in) {
+  auto header = serializer<serialization_header>::read(in);
+  if (std::memcmp(header.magic, serialization_header::Magic, sizeof(header.magic)) != 0
+      || header.version != serialization_header::CurrentVersion
+      || header.byteOrder != serialization_header::ByteOrderMark
+      || header.hashBits != sizeof(size_t) * 8)
+    throw std::runtime_error("not hash table data saved on this platform");
+
+  container.clear();
+  // Every value takes at least the 8 bytes of its hash, so a size that fits in
+  // what is left of in is as much as a truncated stream can claim.
+  uint64_t trusted = std::max<uint64_t>(serialization_header::MaxTrustedBytes / sizeof(typename Container::value_type),
+      serialized_bytes_left(in) / sizeof(uint64_t));
+  container.reserve(std::min<uint64_t>(header.size, trusted));
+  for (uint64_t i = 0; i < header.size; ++i) {
+    serialized_value<Container>::read(container, in, serializer<uint64_t>::read(in));
+    // A different hasher would leave the first key where it cannot be found.
+    if (i == 0 && container.count(serialized_value<Container>::key(*container.begin())) != 1)
+      throw std::runtime_error("hash table data was saved with a different hasher");
+  }
+}
+
+}
@@ -1,8 +1,32 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "flat_hash_set.hpp"
 #include "flat_hash_map.hpp"
+#include "flat_incremental_hash_map.hpp"
+#include "flat_concurrent_hash_map.hpp"
+#include "flat_read_mostly_hash_map.hpp"
+#include "flat_parallel_build.hpp"
+#include "flat_mapped_hash_map.hpp"
+#include "flat_serialization.hpp"
+#include "flat_frozen_hash_map.hpp"
+#include "flat_constexpr_hash_map.hpp"
+#include "flat_huge_page_allocator.hpp"
 
 using namespace flat_hash;
 
@@ -102,9 +126,1327 @@ void test_hash_map() {
   assert(test_map == test_map2);
 }
 
+// Hashes into only a handful of buckets, to produce probe chains much longer
+// than a control word can record.
+struct CollidingHash {
+  size_t operator()(int i) const {
+    return (size_t)(i % 4);
+  }
+};
+
+template <typename Set>
+void check_against_std(Set& set, std::unordered_set<int> const& reference, int range) {
+  assert(set.size() == reference.size());
+  for (int i = 0; i < range; ++i) {
+    if (reference.count(i))
+      assert(set.find(i) != set.end() && *set.find(i) == i);
+    else
+      assert(set.find(i) == set.end());
+  }
+  size_t count = 0;
+  for (int i : set) {
+    assert(reference.count(i));
+    ++count;
+  }
+  assert(count == reference.size());
+}
+
+template <typename Set>
+void test_layout(int range) {
+  Set set;
+  std::unordered_set<int> reference;
+
+  unsigned state = 12345;
+  for (int round = 0; round < 4; ++round) {
+    for (int n = 0; n < range; ++n) {
+      state = state * 1103515245u + 12345u;
+      int i = (int)((state >> 8) % (unsigned)range);
+      if ((state >> 4) % 3 == 0) {
+        assert(set.erase(i) == reference.erase(i));
+      } else {
+        assert(set.insert(i).second == reference.insert(i).second);
+      }
+    }
+    check_against_std(set, reference, range);
+  }
+
+  Set copy = set;
+  check_against_std(copy, reference, range);
+
+  set.clear();
+  reference.clear();
+  check_against_std(set, reference, range);
+}
+
+void test_control_layout() {
+  test_layout<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, control_layout>>(5000);
+  test_layout<hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, control_layout>>(700);
+
+  hash_map<std::string, int, std::hash<std::string>, std::equal_to<std::string>, std::allocator<std::string>, control_layout> test_map;
+  for (int i = 0; i < 1000; ++i)
+    test_map[std::to_string(i)] = i;
+  for (int i = 0; i < 1000; ++i)
+    assert(test_map.at(std::to_string(i)) == i);
+  assert(test_map.find("1000") == test_map.end());
+}
+
+void test_compact_layout() {
+  test_layout<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, compact_layout>>(5000);
+  test_layout<hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout>>(700);
+
+  typedef hash_map<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>, std::allocator<std::string>, compact_layout> CompactMap;
+  CompactMap test_map;
+  for (int i = 0; i < 1000; ++i)
+    test_map[std::to_string(i)] = std::string(40, 'a' + i % 26);
+  for (int i = 0; i < 1000; i += 2)
+    assert(test_map.erase(std::to_string(i)) == 1);
+
+  CompactMap copy = test_map;
+  CompactMap moved = std::move(copy);
+  copy = moved;
+  moved = std::move(test_map);
+  assert(moved.size() == 500u);
+  assert(copy == moved);
+  for (int i = 1; i < 1000; i += 2)
+    assert(copy.at(std::to_string(i)) == std::string(40, 'a' + i % 26));
+  assert(copy.find("0") == copy.end());
+}
+
+void test_find_many() {
+  hash_map<int, int> test_map;
+  for (int i = 0; i < 1000; i += 2)
+    test_map[i] = i * 3;
+
+  std::vector<int> keys;
+  for (int i = 0; i < 100; ++i)
+    keys.push_back((i * 37) % 1000);
+
+  std::vector<hash_map<int, int>::iterator> found;
+  test_map.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+  assert(found.size() == keys.size());
+  size_t present = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(found[i] == test_map.find(keys[i]));
+    if (found[i] != test_map.end()) {
+      assert(found[i]->second == keys[i] * 3);
+      ++present;
+    }
+  }
+  assert(test_map.count_many(keys.begin(), keys.end()) == present);
+
+  hash_map<int, int> const& const_map = test_map;
+  std::vector<hash_map<int, int>::const_iterator> const_found;
+  const_map.find_many(keys.begin(), keys.end(), std::back_inserter(const_found));
+  for (size_t i = 0; i < keys.size(); ++i)
+    assert(const_found[i] == const_map.find(keys[i]));
+
+  hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, control_layout> const test_set(keys.begin(), keys.begin() + 50);
+  std::vector<decltype(test_set.begin())> set_found;
+  test_set.find_many(keys.begin(), keys.end(), std::back_inserter(set_found));
+  for (size_t i = 0; i < keys.size(); ++i)
+    assert(set_found[i] == test_set.find(keys[i]));
+  assert(test_set.count_many(keys.begin() + 25, keys.begin() + 75) == 25u);
+
+  hash_set<int> empty_set;
+  assert(empty_set.count_many(keys.begin(), keys.end()) == 0u);
+}
+
+// Hashes std::string and char const* alike, counting the char const* calls so
+// the test can tell that lookups did not convert to std::string first.
+struct TransparentStringHash {
+  typedef void is_transparent;
+
+  static size_t hashBytes(char const* data, size_t size) {
+    size_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ (unsigned char)data[i]) * 1099511628211u;
+    return hash;
+  }
+
+  size_t operator()(std::string const& key) const {
+    return hashBytes(key.data(), key.size());
+  }
+
+  size_t operator()(char const* key) const {
+    ++*pointerCalls;
+    return hashBytes(key, std::strlen(key));
+  }
+
+  std::shared_ptr<int> pointerCalls = std::make_shared<int>(0);
+};
+
+void test_transparent_lookup() {
+  TransparentStringHash hash;
+  hash_map<std::string, int, TransparentStringHash, std::equal_to<>> test_map(0, hash);
+  for (int i = 0; i < 100; ++i)
+    test_map[std::to_string(i)] = i;
+
+  auto const& const_map = test_map;
+  assert(test_map.find("42")->second == 42);
+  assert(const_map.find("42") == test_map.find(std::string("42")));
+  assert(test_map.find("100") == test_map.end());
+  assert(test_map.count("7") == 1u);
+  assert(test_map.count("x") == 0u);
+  assert(test_map.at("99") == 99);
+  assert(const_map.at("0") == 0);
+  assert(std::distance(test_map.equal_range("5").first, test_map.equal_range("5").second) == 1);
+  assert(test_map.erase("5") == 1u);
+  assert(test_map.erase("5") == 0u);
+  test_map.erase(test_map.find("6"));
+  assert(test_map.size() == 98u);
+  assert(*hash.pointerCalls == 12);
+
+  bool thrown = false;
+  try {
+    test_map.at("missing");
+  } catch (std::out_of_range const&) {
+    thrown = true;
+  }
+  assert(thrown);
+
+  hash_set<std::string, TransparentStringHash, std::equal_to<>, std::allocator<std::string>, compact_layout> test_set = {"a", "b", "c"};
+  assert(test_set.count("b") == 1u);
+  assert(*test_set.find("c") == "c");
+  assert(test_set.erase("a") == 1u);
+  assert(test_set.size() == 2u);
+}
+
+// Counts every construction, so tests can check that a value was built only
+// when it was actually inserted.
+struct Counted {
+  static int constructions;
+
+  Counted(int value = 0) : value(value) {
+    ++constructions;
+  }
+
+  Counted(Counted const& other) : value(other.value) {
+    ++constructions;
+  }
+
+  Counted(Counted&& other) : value(other.value) {
+    ++constructions;
+  }
+
+  Counted& operator=(Counted const&) = default;
+  Counted& operator=(Counted&&) = default;
+
+  int value;
+};
+
+int Counted::constructions = 0;
+
+void test_try_emplace() {
+  hash_map<int, Counted> test_map;
+  for (int i = 0; i < 100; ++i)
+    assert(test_map.try_emplace(i, i).second);
+  Counted::constructions = 0;
+  for (int i = 0; i < 100; ++i) {
+    auto res = test_map.try_emplace(i, -1);
+    assert(!res.second);
+    assert(res.first->second.value == i);
+  }
+  assert(Counted::constructions == 0);
+
+  auto res = test_map.try_emplace(100, 7);
+  assert(res.second && res.first->second.value == 7);
+  assert(Counted::constructions == 1);
+
+  assert(!test_map.insert_or_assign(5, Counted(50)).second);
+  assert(test_map.at(5).value == 50);
+  assert(test_map.insert_or_assign(101, Counted(1)).second);
+  assert(test_map.at(101).value == 1);
+
+  hash_map<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>, std::allocator<std::string>, compact_layout> string_map;
+  std::string key = "key";
+  string_map.try_emplace(std::move(key), 3, 'x');
+  assert(string_map.at("key") == "xxx");
+  key = "key";
+  assert(!string_map.try_emplace(std::move(key), "y").second);
+  assert(key == "key");
+
+  // operator[] with a key that lives in the table, at every size so that some of
+  // them land right on a growth threshold.
+  hash_map<std::string, int> self_map;
+  for (int i = 0; i < 200; ++i) {
+    self_map[std::to_string(i)] = i;
+    assert(self_map[self_map.begin()->first] == self_map.begin()->second);
+    assert(self_map.size() == (size_t)i + 1);
+  }
+}
+
+struct CountingHash {
+  size_t operator()(int key) const {
+    ++*calls;
+    return std::hash<int>()(key);
+  }
+
+  std::shared_ptr<int> calls = std::make_shared<int>(0);
+};
+
+void test_growth() {
+  // Growing reuses the stored hashes, so keys are hashed once, on insert.
+  CountingHash hash;
+  hash_set<int, CountingHash> test_set(0, hash);
+  for (int i = 0; i < 10000; ++i)
+    test_set.insert(i);
+  assert(*hash.calls == 10000);
+  for (int i = 0; i < 10000; ++i)
+    assert(test_set.count(i) == 1);
+
+  // Without stored hashes, keys are hashed again when the table grows.
+  CountingHash compact_hash;
+  hash_set<int, CountingHash, std::equal_to<int>, std::allocator<int>, compact_layout> compact_set(0, compact_hash);
+  for (int i = 0; i < 10000; ++i)
+    compact_set.insert(i);
+  assert(*compact_hash.calls > 10000);
+  for (int i = 0; i < 10000; ++i)
+    assert(compact_set.count(i) == 1);
+}
+
+template <typename Map>
+void test_incremental(int range) {
+  Map test_map;
+  std::unordered_map<int, int> std_map;
+  bool migrated = false;
+  unsigned state = 7;
+  for (int i = 0; i < 20000; ++i) {
+    state = state * 1103515245 + 12345;
+    int key = (state >> 8) % range;
+    if (state % 4 == 0) {
+      assert(test_map.erase(key) == std_map.erase(key));
+    } else {
+      test_map[key] = i;
+      std_map[key] = i;
+    }
+    migrated = migrated || test_map.migrating();
+    assert(test_map.size() == std_map.size());
+  }
+  assert(migrated);
+
+  size_t iterated = 0;
+  for (auto const& p : test_map) {
+    assert(std_map.at(p.first) == p.second);
+    ++iterated;
+  }
+  assert(iterated == std_map.size());
+  for (auto const& p : std_map)
+    assert(test_map.at(p.first) == p.second);
+
+  test_map.finish_migration();
+  assert(!test_map.migrating());
+  for (auto const& p : std_map)
+    assert(test_map.find(p.first)->second == p.second);
+  test_map.clear();
+  assert(test_map.empty() && test_map.begin() == test_map.end());
+}
+
+// Keys passed by reference to values of the map itself must survive the
+// migration step an operation does.  The last value iterated is in the top
+// filled bucket of the old array, the next one a migration moves.
+void test_incremental_aliased_keys() {
+  incremental_hash_map<std::string, int> test_map;
+  auto last = [&test_map]() {
+    auto i = test_map.begin();
+    for (auto j = i; j != test_map.end(); ++j)
+      i = j;
+    return i;
+  };
+
+  int next = 0;
+  while (!test_map.migrating() || test_map.size() < 100) {
+    test_map[std::string(32, 'x') + std::to_string(next)] = next;
+    ++next;
+  }
+  size_t size = test_map.size();
+  for (int i = 0; i < 50; ++i) {
+    assert(!test_map.try_emplace(last()->first, -1).second);
+    ++test_map[last()->first];
+    assert(test_map.size() == size);
+  }
+  while (!test_map.empty()) {
+    assert(test_map.erase(last()->first) == 1);
+    assert(test_map.size() == --size);
+  }
+}
+
+void test_concurrent() {
+  concurrent_hash_map<int, int> test_map(16);
+  int const threadCount = 8;
+  int const perThread = 5000;
+  test_map.insert({-1, 0});
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&test_map, t]() {
+        for (int i = 0; i < perThread; ++i) {
+          int key = t * perThread + i;
+          assert(test_map.try_emplace(key, key * 2));
+          assert(!test_map.insert({key, 0}));
+          int value = 0;
+          assert(test_map.find(key, value) && value == key * 2);
+          // Every thread bumps the same counter, which must end up exact.
+          assert(test_map.visit(-1, [](std::pair<int const, int>& p) { ++p.second; }));
+          if (i % 2 == 0)
+            assert(test_map.erase(key) == 1);
+        }
+      });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  assert(test_map.size() == (size_t)(threadCount * perThread / 2 + 1));
+  int counter = 0;
+  assert(test_map.find(-1, counter) && counter == threadCount * perThread);
+  for (int key = 0; key < threadCount * perThread; ++key)
+    assert(test_map.count(key) == (size_t)(key % perThread % 2));
+
+  long sum = 0;
+  test_map.for_each([&sum](std::pair<int const, int> const& p) {
+      if (p.first >= 0)
+        sum += p.second;
+    });
+  long expected = 0;
+  for (int key = 1; key < threadCount * perThread; key += 2)
+    expected += key * 2;
+  assert(sum == expected);
+
+  test_map.clear();
+  assert(test_map.empty());
+
+  concurrent_hash_map<int, int> single(1);
+  for (int key = 0; key < 1000; ++key)
+    assert(single.try_emplace(key, key));
+  assert(single.size() == 1000 && single.find(999, counter) && counter == 999);
+}
+
+struct TwoHalves {
+  long value;
+  long negated;
+};
+
+void test_read_mostly() {
+  read_mostly_hash_map<int, TwoHalves> test_map;
+  int const stableCount = 1000;
+  int const writes = 20000;
+  for (int key = 0; key < stableCount; ++key)
+    assert(test_map.insert({key, {key, -key}}));
+  assert(!test_map.insert({0, {1, -1}}));
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&test_map, &done, t]() {
+        int key = t;
+        while (!done.load()) {
+          // A value must never be seen half written, not even left behind by
+          // a find that missed, and keys that are never erased must always be
+          // found, even while the table grows.
+          TwoHalves found{1, 1};
+          if (test_map.find(key, found))
+            assert(found.negated == -found.value);
+          else
+            assert(key >= stableCount && found.value == 1 && found.negated == 1);
+          key = (key + 7) % (stableCount + writes);
+        }
+      });
+  }
+
+  for (int i = 0; i < writes; ++i) {
+    int key = stableCount + i;
+    assert(test_map.try_emplace(key, TwoHalves{key, -key}));
+    assert(!test_map.insert_or_assign(i % stableCount, TwoHalves{i, -i}));
+    if (i % 3 == 0)
+      assert(test_map.erase(key) == 1);
+  }
+  done.store(true);
+  for (auto& thread : readers)
+    thread.join();
+
+  assert(test_map.size() == (size_t)(stableCount + writes - (writes + 2) / 3));
+  TwoHalves found;
+  assert(test_map.find(stableCount + 1, found) && found.value == stableCount + 1);
+  assert(test_map.count(stableCount) == 0);
+  size_t visited = 0;
+  test_map.for_each([&visited](std::pair<int const, TwoHalves> const& p) {
+      assert(p.second.negated == -p.second.value);
+      ++visited;
+    });
+  assert(visited == test_map.size());
+
+  test_map.clear();
+  assert(test_map.empty() && !test_map.find(1, found) && found.value == stableCount + 1);
+}
+
+// Gives runs of 8 keys the same target bucket, so that runs cross from one
+// bulkInsert range into the next.
+struct ClusteredHash {
+  // Keeps the table from mixing the hashes, which would spread the clusters.
+  typedef void is_avalanching;
+
+  size_t operator()(int i) const {
+    return (size_t)(i / 8 * 8);
+  }
+};
+
+void test_hash_mixing() {
+  static_assert(!is_avalanching<std::hash<int>>::value, "");
+  static_assert(is_avalanching<ClusteredHash>::value, "");
+  assert(hash_key(ClusteredHash(), 17) == 16);
+
+  // Multiples of 1024 and 64-byte aligned pointers all have the same low bits,
+  // which mixing must spread over a 1024 bucket table.
+  std::vector<bool> strided(1024);
+  std::vector<bool> pointers(1024);
+  for (size_t i = 0; i < 1024; ++i) {
+    strided[hash_key(std::hash<size_t>(), i * 1024) & 1023] = true;
+    pointers[hash_key(std::hash<void*>(), (void*)(0x7f0000000000 + i * 64)) & 1023] = true;
+  }
+  assert(std::count(strided.begin(), strided.end(), true) > 600);
+  assert(std::count(pointers.begin(), pointers.end(), true) > 600);
+
+  hash_map<size_t, int> test_map;
+  for (size_t i = 0; i < 100000; ++i)
+    test_map[i * 1024] = (int)i;
+  for (size_t i = 0; i < 100000; ++i)
+    assert(test_map.at(i * 1024) == (int)i && test_map.count(i * 1024 + 1) == 0);
+}
+
+// Sends every key to the second to last of 8 buckets, so the run wraps.
+struct WrappingHash {
+  typedef void is_avalanching;
+
+  size_t operator()(int) const {
+    return 6;
+  }
+};
+
+void test_stats() {
+  hash_set<int> empty_set;
+  hash_table_stats empty = empty_set.stats();
+  assert(empty.size == 0 && empty.bucketCount == 0 && empty.probeDistanceHistogram.empty() && empty.longestRun == 0);
+
+  hash_set<int, CollidingHash> colliding;
+  for (int i = 0; i < 40; ++i)
+    colliding.insert(i);
+  hash_table_stats stats = colliding.stats();
+  assert(stats.size == 40 && stats.loadFactor == 40.0 / stats.bucketCount);
+  assert(stats.maxProbeDistance + 1 == stats.probeDistanceHistogram.size() && stats.maxProbeDistance >= 9);
+  size_t count = 0;
+  size_t totalDistance = 0;
+  for (size_t d = 0; d < stats.probeDistanceHistogram.size(); ++d) {
+    count += stats.probeDistanceHistogram[d];
+    totalDistance += d * stats.probeDistanceHistogram[d];
+  }
+  assert(count == 40 && stats.meanProbeDistance == totalDistance / 40.0);
+  assert(stats.longestRun >= 10 && stats.bytesUsed >= stats.bucketCount * sizeof(int));
+
+  hash_set<int, WrappingHash> wrapping = {1, 2, 3, 4, 5};
+  hash_table_stats wrapped = wrapping.stats();
+  assert(wrapped.bucketCount == 8 && wrapped.longestRun == 5 && wrapped.maxProbeDistance == 4);
+
+#if defined(FLAT_HASH_STATS)
+  assert(stats.inserts == 40 && stats.insertProbes >= 40 && stats.rehashes >= 3 && stats.finds == 0);
+  for (int i = 0; i < 80; ++i)
+    colliding.count(i);
+  stats = colliding.stats();
+  assert(stats.finds == 80 && stats.findProbes > stats.insertProbes);
+#endif
+}
+
+// Passes keys through as they are, so keys that are multiples of a large power
+// of two all target bucket zero, as keys picked to collide would.
+struct IdentityHash {
+  typedef void is_avalanching;
+
+  size_t operator()(int i) const {
+    return (size_t)i;
+  }
+};
+
+void test_probe_guard() {
+  hash_map<int, int, IdentityHash> guarded;
+  for (int i = 0; i < 5000; ++i)
+    guarded[i << 16] = i;
+  assert(guarded.bucket_seed() != 0 && guarded.stats().maxProbeDistance <= guarded.max_probe_distance());
+  hash_map<int, int, IdentityHash> copied = guarded;
+  for (int i = 0; i < 5000; ++i)
+    assert(guarded.at(i << 16) == i && copied.at(i << 16) == i && guarded.count((i << 16) + 1) == 0);
+
+  // A reseeded table writes and maps like any other.
+  write_mapped_hash_map(guarded, "test_mapped.tmp");
+  {
+    mapped_hash_map<int, int, IdentityHash> mapped("test_mapped.tmp");
+    for (int i = 0; i < 5000; ++i)
+      assert(mapped.find(i << 16)->second == i && mapped.count((i << 16) + 1) == 0);
+  }
+  std::remove("test_mapped.tmp");
+
+  hash_map<int, int, IdentityHash, std::equal_to<int>, std::allocator<int>, control_layout> unguarded;
+  unguarded.max_probe_distance((size_t)-1);
+  for (int i = 0; i < 2000; ++i)
+    unguarded[i << 16] = i;
+  assert(unguarded.bucket_seed() == 0 && unguarded.stats().maxProbeDistance == 1999);
+
+  // Equal hashes cannot be separated, growing stops once the table is sparse.
+  hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout> colliding;
+  for (int i = 0; i < 2000; ++i)
+    colliding.insert(i);
+  assert(colliding.size() == 2000 && colliding.stats().loadFactor > 0.15);
+  for (int i = 0; i < 2000; ++i)
+    assert(colliding.count(i) == 1);
+}
+
+// Sends every key to one of the last buckets, so that runs wrap around.
+struct EndHash {
+  typedef void is_avalanching;
+
+  size_t operator()(int i) const {
+    return ~(size_t)0 - (size_t)(i % 3);
+  }
+};
+
+template <typename Set>
+void test_erase_if(int range) {
+  Set set;
+  std::unordered_set<int> reference;
+  for (int i = 0; i < range; ++i) {
+    set.insert(i);
+    reference.insert(i);
+  }
+
+  for (int divisor : {7, 3, 2}) {
+    size_t erased = erase_if(set, [divisor](int i) { return i % divisor == 0; });
+    size_t referenceErased = 0;
+    for (auto i = reference.begin(); i != reference.end();) {
+      if (*i % divisor == 0) {
+        i = reference.erase(i);
+        ++referenceErased;
+      } else {
+        ++i;
+      }
+    }
+    assert(erased == referenceErased);
+    check_against_std(set, reference, range);
+
+    // The table is still consistent for inserts after the sweep.
+    for (int i = 0; i < range; i += 14) {
+      set.insert(i);
+      reference.insert(i);
+    }
+    check_against_std(set, reference, range);
+  }
+
+  assert(set.retain([](int) { return true; }) == 0);
+  assert(set.retain([](int) { return false; }) == reference.size() && set.empty());
+  check_against_std(set, std::unordered_set<int>(), range);
+}
+
+void test_erase_if() {
+  test_erase_if<hash_set<int>>(5000);
+  test_erase_if<hash_set<int, ClusteredHash, std::equal_to<int>, std::allocator<int>, control_layout>>(3000);
+  test_erase_if<hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout>>(500);
+  test_erase_if<hash_set<int, EndHash>>(60);
+  test_erase_if<hash_set<int, EndHash, std::equal_to<int>, std::allocator<int>, control_layout>>(60);
+
+  hash_map<std::string, int> map;
+  for (int i = 0; i < 1000; ++i)
+    map[std::to_string(i)] = i;
+  assert(map.retain([](std::pair<std::string const, int>& p) { return ++p.second % 2 == 0; }) == 500);
+  for (int i = 0; i < 1000; ++i)
+    assert(i % 2 == 0 ? map.count(std::to_string(i)) == 0 : map.at(std::to_string(i)) == i + 1);
+
+  concurrent_hash_map<int, int> concurrent(4);
+  for (int i = 0; i < 1000; ++i)
+    concurrent.insert({i, i});
+  assert(concurrent.erase_if([](std::pair<int const, int> const& p) { return p.second < 250; }) == 250);
+  assert(concurrent.size() == 750 && concurrent.count(249) == 0 && concurrent.count(250) == 1);
+}
+
+// A hasher with state, so that tables of the same type can hash differently.
+struct SeededHash {
+  size_t operator()(int i) const {
+    return std::hash<int>()(i) ^ seed;
+  }
+
+  size_t seed;
+};
+
+void test_node_handles() {
+  typedef hash_map<std::string, int> Map;
+  Map source;
+  for (int i = 0; i < 1000; ++i)
+    source[std::to_string(i)] = i;
+
+  Map::node_type missing = source.extract("none");
+  assert(missing.empty() && !missing);
+
+  Map::node_type node = source.extract("7");
+  assert(node && node.mapped() == 7 && source.size() == 999 && source.count("7") == 0);
+  node.mapped() = 70;
+  Map target;
+  Map::insert_return_type res = target.insert(std::move(node));
+  assert(res.inserted && res.position->second == 70 && res.node.empty() && target.at("7") == 70);
+
+  // A key changed in the node is hashed again.
+  node = source.extract(source.find("8"));
+  node.key() = "eight";
+  assert(target.insert(std::move(node)).inserted && target.at("eight") == 8 && target.count("8") == 0);
+
+  // An insert that finds the key hands the node back.
+  target["9"] = -9;
+  res = target.insert(source.extract("9"));
+  assert(!res.inserted && res.position->second == -9 && res.node.mapped() == 9);
+
+  target["10"] = -10;
+  target.merge(source);
+  assert(source.size() == 1 && source.at("10") == 10);
+  assert(target.size() == 1000 && target.at("10") == -10 && target.at("11") == 11 && target.at("999") == 999);
+
+  typedef hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout> CompactSet;
+  CompactSet first;
+  CompactSet second;
+  std::unordered_set<int> reference;
+  for (int i = 0; i < 600; ++i) {
+    (i % 2 == 0 ? first : second).insert(i);
+    if (i % 3 == 0)
+      second.insert(i);
+    reference.insert(i);
+  }
+  first.merge(std::move(second));
+  check_against_std(first, reference, 600);
+  assert(second.size() == 100 && first.insert(second.extract(second.begin())).node.value() % 6 == 0);
+
+  typedef hash_set<int, SeededHash> SeededSet;
+  SeededSet seeded(0, SeededHash{1});
+  SeededSet otherSeeded(0, SeededHash{12345});
+  for (int i = 0; i < 1000; ++i)
+    (i < 500 ? seeded : otherSeeded).insert(i);
+  seeded.merge(otherSeeded);
+  otherSeeded.insert(seeded.extract(999));
+  assert(seeded.size() == 999 && otherSeeded.size() == 1 && otherSeeded.count(999) == 1);
+  for (int i = 0; i < 999; ++i)
+    assert(seeded.count(i) == 1);
+
+  // Maps with other hashers or layouts share the node type, but hash the keys
+  // again.
+  hash_map<int, int, IdentityHash> identity;
+  hash_map<int, int> mixed;
+  hash_map<int, int, IdentityHash, std::equal_to<int>, std::allocator<int>, compact_layout> compact;
+  for (int i = 0; i < 1000; ++i)
+    identity[i] = i;
+  for (int i = 0; i < 1000; ++i)
+    assert(mixed.insert(identity.extract(i)).inserted);
+  for (int i = 0; i < 1000; ++i)
+    assert(compact.insert(mixed.extract(i)).inserted);
+  for (int i = 0; i < 1000; ++i)
+    assert(identity.insert(compact.extract(i)).inserted);
+  assert(mixed.empty() && compact.empty() && identity.size() == 1000);
+  for (int i = 0; i < 1000; ++i)
+    assert(identity.at(i) == i);
+}
+
+template <typename Set>
+void test_load_factor() {
+  Set set;
+  assert(set.bucket_count() == 0 && set.load_factor() == 0.0f && set.max_load_factor() == 0.7f);
+  for (int i = 0; i < 10000; ++i)
+    set.insert(i);
+  size_t grown = set.bucket_count();
+  assert(set.load_factor() <= 0.7f);
+
+  // Erasing keeps the buckets until asked to give them back.
+  for (int i = 100; i < 10000; ++i)
+    set.erase(i);
+  assert(set.bucket_count() == grown);
+  set.shrink_to_fit();
+  assert(set.bucket_count() == 256 && set.size() == 100);
+  for (int i = 0; i < 200; ++i)
+    assert(set.count(i) == (i < 100 ? 1u : 0u));
+
+  set.rehash(1000);
+  assert(set.bucket_count() == 1024 && set.count(99) == 1);
+  set.rehash(0);
+  assert(set.bucket_count() == 256);
+
+  // Bucket counts no allocator could hold are refused rather than wrapping.
+  for (size_t huge : {set.max_bucket_count() + 1, (size_t)-1}) {
+    bool threw = false;
+    try {
+      set.rehash(huge);
+    } catch (std::length_error const&) {
+      threw = true;
+    }
+    assert(threw && set.bucket_count() == 256 && set.size() == 100);
+    threw = false;
+    try {
+      set.reserve(huge);
+    } catch (std::length_error const&) {
+      threw = true;
+    }
+    assert(threw && set.bucket_count() == 256 && set.size() == 100);
+  }
+
+  // Raising the limit lets the table fill further before growing, lowering it
+  // grows the table at once.
+  set.max_load_factor(0.9f);
+  for (int i = 100; i < 230; ++i)
+    set.insert(i);
+  assert(set.bucket_count() == 256 && set.load_factor() > 0.85f);
+  for (int i = 0; i < 300; ++i)
+    assert(set.count(i) == (i < 230 ? 1u : 0u));
+  set.max_load_factor(0.5f);
+  assert(set.bucket_count() == 512 && set.load_factor() <= 0.5f);
+  set.max_load_factor(2.0f);
+  assert(set.max_load_factor() == 0.95f);
+
+  Set copied = set;
+  assert(copied.max_load_factor() == 0.95f && copied.size() == 230);
+
+  set.clear();
+  set.shrink_to_fit();
+  assert(set.bucket_count() == 0 && set.begin() == set.end() && set.count(1) == 0);
+  set.insert(1);
+  assert(set.count(1) == 1 && set.size() == 1);
+}
+
+template <typename Set>
+void test_sparse_iteration() {
+  Set set;
+  for (int i = 0; i < 10000; ++i)
+    set.insert(i);
+  set.retain([](int i) { return i % 97 == 0; });
+
+  std::set<int> seen;
+  for (int i : set)
+    seen.insert(i);
+  assert(seen.size() == set.size() && seen.size() == 104 && *seen.rbegin() == 9991);
+  for (int i : seen)
+    assert(i % 97 == 0);
+
+  // Erasing through iterators visits each remaining value once.
+  size_t visited = 0;
+  for (auto i = set.begin(); i != set.end(); ++visited)
+    i = *i % 2 == 0 ? set.erase(i) : std::next(i);
+  assert(visited == 104 && set.size() == 52);
+
+  set.clear();
+  assert(set.begin() == set.end() && set.empty());
+  set.insert(5);
+  assert(*set.begin() == 5 && std::next(set.begin()) == set.end());
+
+  // A large table reused as scratch space, with values spread far apart.
+  set.clear();
+  set.reserve(100000);
+  size_t buckets = set.bucket_count();
+  for (int round = 0; round < 50; ++round) {
+    for (int i = 0; i < 5; ++i)
+      set.insert(round * 7919 + i * 20011);
+    assert(set.size() == 5 && set.count(round * 7919) == 1 && set.count(round * 7919 - 7919) == 0);
+    set.clear();
+    assert(set.empty() && set.begin() == set.end());
+  }
+  assert(set.bucket_count() == buckets);
+}
+
+// A minimal C++11 allocator, with no rebind member, that counts what is
+// allocated through it and does not propagate on move assignment.
+template <typename T>
+struct CountingAllocator {
+  typedef T value_type;
+
+  explicit CountingAllocator(size_t* allocated) : allocated(allocated) {}
+  template <typename U>
+  CountingAllocator(CountingAllocator<U> const& other) : allocated(other.allocated) {}
+
+  T* allocate(size_t n) {
+    *allocated += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    *allocated -= n * sizeof(T);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(CountingAllocator<U> const& rhs) const {
+    return allocated == rhs.allocated;
+  }
+
+  template <typename U>
+  bool operator!=(CountingAllocator<U> const& rhs) const {
+    return allocated != rhs.allocated;
+  }
+
+  size_t* allocated;
+};
+
+void test_allocator() {
+  size_t firstAllocated = 0;
+  size_t secondAllocated = 0;
+  {
+    typedef hash_map<int, std::string, std::hash<int>, std::equal_to<int>, CountingAllocator<int>> Map;
+    Map first{CountingAllocator<int>(&firstAllocated)};
+    for (int i = 0; i < 1000; ++i)
+      first[i] = std::to_string(i);
+    assert(firstAllocated != 0 && first.get_allocator() == CountingAllocator<int>(&firstAllocated));
+
+    Map second(first, CountingAllocator<int>(&secondAllocated));
+    assert(secondAllocated != 0 && second == first);
+
+    // Unequal allocators that do not propagate move the values, not the buckets.
+    Map third{CountingAllocator<int>(&secondAllocated)};
+    size_t beforeMove = secondAllocated;
+    third = std::move(first);
+    assert(secondAllocated > beforeMove && third.get_allocator() == CountingAllocator<int>(&secondAllocated));
+    assert(third.size() == 1000 && third.at(999) == "999");
+    first.clear();
+
+    hash_set<int, std::hash<int>, std::equal_to<int>, CountingAllocator<int>, compact_layout> set{CountingAllocator<int>(&firstAllocated)};
+    set.insert({1, 2, 3});
+    assert(set.count(2) == 1);
+  }
+  assert(firstAllocated == 0 && secondAllocated == 0);
+}
+
+#if defined(FLAT_HASH_PMR)
+void test_pmr() {
+  // Nothing below may allocate from anywhere but the arenas.
+  std::pmr::memory_resource* defaultResource = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+  {
+    static char firstBuffer[1 << 20];
+    static char secondBuffer[1 << 20];
+    std::pmr::monotonic_buffer_resource firstArena(firstBuffer, sizeof(firstBuffer), std::pmr::null_memory_resource());
+    std::pmr::monotonic_buffer_resource secondArena(secondBuffer, sizeof(secondBuffer), std::pmr::null_memory_resource());
+
+    pmr::hash_map<int, std::pmr::string> first(&firstArena);
+    for (int i = 0; i < 1000; ++i)
+      first.try_emplace(i, "a string too long for the small string buffer");
+    assert(first.at(999).get_allocator().resource() == &firstArena);
+
+    pmr::hash_map<int, std::pmr::string> second(first, &secondArena);
+    assert(second == first && second.at(0).get_allocator().resource() == &secondArena);
+
+    pmr::hash_map<int, std::pmr::string> third(&secondArena);
+    third = std::move(first);
+    assert(third.size() == 1000 && third.at(0).get_allocator().resource() == &secondArena);
+
+    pmr::hash_set<std::pmr::string> set(&firstArena);
+    set.insert(std::pmr::string("another string too long for the small string buffer", &firstArena));
+    assert(set.count(std::pmr::string("another string too long for the small string buffer", &firstArena)) == 1);
+  }
+  std::pmr::set_default_resource(defaultResource);
+}
+#endif
+
+void test_huge_page_allocator() {
+  // Small enough to map even the first bucket arrays, the kernel may or may
+  // not honour the page size and placement, but the table works either way.
+  for (page_size pages : {page_size::normal, page_size::transparent, page_size::huge_2mb, page_size::huge_1gb}) {
+    huge_page_options options;
+    options.pages = pages;
+    options.placement = pages == page_size::normal ? numa_placement::local : numa_placement::interleave;
+    options.minSize = 4096;
+
+    typedef hash_map<int, int, std::hash<int>, std::equal_to<int>, huge_page_allocator<int>> Map;
+    Map map{huge_page_allocator<int>(options)};
+    for (int i = 0; i < 100000; ++i)
+      map[i] = i;
+    Map copy = map;
+    for (int i = 0; i < 100000; ++i)
+      assert(map.at(i) == i && copy.at(i) == i && map.count(i + 100000) == 0);
+    assert(map.get_allocator() == huge_page_allocator<int>(options) && map.get_allocator().options().placement == options.placement);
+  }
+
+  huge_page_options bound;
+  bound.placement = numa_placement::bind;
+  bound.nodeMask = online_numa_nodes() & (~online_numa_nodes() + 1);
+  bound.minSize = 4096;
+  hash_set<int, std::hash<int>, std::equal_to<int>, huge_page_allocator<int>, compact_layout> set{huge_page_allocator<int>(bound)};
+  for (int i = 0; i < 100000; ++i)
+    set.insert(i);
+  assert(set.size() == 100000 && set.count(99999) == 1);
+
+  // Allocators placing memory differently do not take over each other's.
+  huge_page_options interleaved = bound;
+  interleaved.placement = numa_placement::interleave;
+  huge_page_options otherNode = bound;
+  otherNode.nodeMask = bound.nodeMask << 1;
+  assert(huge_page_allocator<int>(bound) == huge_page_allocator<long>(bound));
+  assert(huge_page_allocator<int>(bound) != huge_page_allocator<int>(interleaved));
+  assert(huge_page_allocator<int>(bound) != huge_page_allocator<int>(otherNode));
+
+  // 1 GB pages are only used for allocations of at least 1 GB.
+  huge_page_options gigabyte;
+  gigabyte.pages = page_size::huge_1gb;
+  assert(huge_page_mapping_size((size_t)3 << 20, gigabyte) == (size_t)4 << 20);
+  assert(huge_page_mapping_size(((size_t)1 << 30) + 1, gigabyte) == (size_t)2 << 30);
+
+  huge_page_allocator<uint64_t> allocator(gigabyte);
+  bool threw = false;
+  try {
+    allocator.allocate(allocator.max_size() + 1);
+  } catch (std::bad_array_new_length const&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+// Runs the tasks one after another, backwards, to show bulkInsert does not
+// depend on the order they run in.
+struct ReverseRunner {
+  template <typename Task>
+  void operator()(size_t count, Task const& task) const {
+    for (size_t i = count; i > 0; --i)
+      task(i - 1);
+  }
+};
+
+template <typename Map>
+void test_parallel_insert() {
+  // Every key comes up twice, and the first of the two must win.
+  std::vector<std::pair<int, int>> values;
+  for (int i = 0; i < 60000; ++i)
+    values.push_back({(i * 7919) % 30000, i});
+
+  Map serial;
+  serial.insert(values.begin(), values.end());
+  assert(serial.size() == 30000);
+
+  Map bulk;
+  bulk.insert_parallel(values.begin(), values.end(), 8, ReverseRunner());
+  assert(bulk == serial);
+  for (auto const& p : serial)
+    assert(bulk.at(p.first) == p.second);
+  size_t iterated = 0;
+  for (auto const& p : bulk) {
+    assert(serial.at(p.first) == p.second);
+    ++iterated;
+  }
+  assert(iterated == bulk.size());
+
+  Map threaded;
+  parallel_insert(threaded, values.begin(), values.end(), 4);
+  assert(threaded == serial);
+
+  // Into a non-empty map this falls back to inserting one by one.
+  parallel_insert(threaded, values.begin(), values.begin() + 10, 4);
+  assert(threaded == serial);
+  Map single;
+  single.insert_parallel(values.begin(), values.end(), 1, ReverseRunner());
+  assert(single == serial);
+
+  std::vector<int> keys;
+  for (auto const& p : values)
+    keys.push_back(p.first);
+  hash_set<int, typename Map::hasher> keySet;
+  parallel_insert(keySet, keys.begin(), keys.end(), 8);
+  assert(keySet.size() == serial.size());
+  for (auto const& p : serial)
+    assert(keySet.count(p.first) == 1);
+}
+
+template <typename Map>
+void test_mapped(char const* path) {
+  Map source;
+  for (int i = 0; i < 5000; ++i)
+    source[i * 3] = i;
+  for (int i = 0; i < 5000; i += 4)
+    source.erase(i * 3);
+
+  write_mapped_hash_map(source, path);
+  mapped_hash_map<int, int, typename Map::hasher> mapped(path);
+  assert(mapped.size() == source.size());
+  assert(mapped.bucket_count() >= source.size());
+  for (int i = 0; i < 15000; ++i) {
+    assert(mapped.count(i) == source.count(i));
+    if (source.count(i))
+      assert(mapped.at(i) == source.at(i) && mapped.find(i)->second == source.at(i));
+  }
+
+  size_t iterated = 0;
+  for (auto const& p : mapped) {
+    assert(source.at(p.first) == p.second);
+    ++iterated;
+  }
+  assert(iterated == source.size());
+
+  // Moving hands over the mapping.
+  auto moved = std::move(mapped);
+  assert(moved.at(3) == 1);
+
+  // Files for another value type are refused.
+  bool threw = false;
+  try {
+    mapped_hash_map<int, long> wrong(path);
+  } catch (std::runtime_error const&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // So are headers with sizes or offsets that do not fit the file, whatever
+  // they would overflow to.
+  std::string file;
+  {
+    std::ifstream in(path, std::ios::binary);
+    file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  auto refused = [&](size_t offset, uint64_t value) {
+    std::string corrupt = file;
+    corrupt.replace(offset, sizeof(uint64_t), (char const*)&value, sizeof(uint64_t));
+    {
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      out.write(corrupt.data(), corrupt.size());
+    }
+    try {
+      mapped_hash_map<int, int, typename Map::hasher> corrupted(path);
+    } catch (std::runtime_error const&) {
+      return true;
+    }
+    return false;
+  };
+  mapped_file_header header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  assert(refused(offsetof(mapped_file_header, bucketCount), (uint64_t)1 << 61));
+  assert(refused(offsetof(mapped_file_header, bucketCount), header.bucketCount * 2));
+  assert(refused(offsetof(mapped_file_header, size), header.bucketCount + 1));
+  assert(refused(offsetof(mapped_file_header, hashesOffset), header.hashesOffset + 4));
+  assert(refused(offsetof(mapped_file_header, hashesOffset), (uint64_t)-8));
+  assert(refused(offsetof(mapped_file_header, valuesOffset), header.valuesOffset + 1));
+  assert(refused(offsetof(mapped_file_header, valuesOffset), (uint64_t)-4096));
+  assert(!refused(offsetof(mapped_file_header, size), header.size));
+
+  write_mapped_hash_map(Map(), path);
+  mapped_hash_map<int, int, typename Map::hasher> empty(path);
+  assert(empty.empty() && empty.begin() == empty.end() && empty.count(3) == 0);
+  std::remove(path);
+}
+
+void test_serialization() {
+  hash_map<std::string, std::vector<std::pair<std::string, int>>> source;
+  for (int i = 0; i < 2000; ++i)
+    source[std::to_string(i)] = {{"a" + std::to_string(i), i}, {"", -i}};
+  source.erase("7");
+
+  std::stringstream stream;
+  save(source, stream);
+  decltype(source) loaded = {{"stale", {}}};
+  load(loaded, stream);
+  assert(loaded == source);
+  assert(loaded.at("12")[0].first == "a12" && loaded.count("7") == 0);
+  loaded["new"];
+  assert(loaded.size() == source.size() + 1);
+
+  // More values than MaxTrustedBytes would size the table for still load into
+  // one sized up front when the stream can tell how much is left.
+  hash_map<std::string, std::string> large;
+  for (int i = 0; i < 40000; ++i)
+    large[std::to_string(i)] = std::to_string(i * 7);
+  assert(large.size() * sizeof(std::pair<std::string const, std::string>) > serialization_header::MaxTrustedBytes);
+  std::stringstream largeStream;
+  save(large, largeStream);
+  decltype(large) loadedLarge;
+  load(loadedLarge, largeStream);
+  decltype(large) reserved;
+  reserved.reserve(large.size());
+  assert(loadedLarge == large && loadedLarge.bucket_count() == reserved.bucket_count());
+#if defined(FLAT_HASH_STATS)
+  assert(loadedLarge.stats().rehashes == 1);
+#endif
+
+  hash_set<int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout> set;
+  for (int i = 0; i < 500; ++i)
+    set.insert(i * 5 + 100);
+  std::stringstream setStream;
+  save(set, setStream);
+  decltype(set) loadedSet;
+  load(loadedSet, setStream);
+  assert(loadedSet == set);
+
+  // Truncated data and data saved with another hasher are refused.
+  std::string data = setStream.str();
+  std::stringstream truncated(data.substr(0, data.size() - 3));
+  bool threw = false;
+  try {
+    load(loadedSet, truncated);
+  } catch (std::runtime_error const&) {
+    threw = true;
+  }
+  assert(threw);
+
+  std::stringstream rehashed(data);
+  hash_set<int> otherHasher;
+  threw = false;
+  try {
+    load(otherHasher, rehashed);
+  } catch (std::runtime_error const&) {
+    threw = true;
+  }
+  assert(threw);
+
+  // So are a key saved twice, and sizes far beyond the data that follows,
+  // without allocating for them first.
+  size_t const headerSize = sizeof(serialization_header);
+  size_t const entrySize = sizeof(uint64_t) + sizeof(int);
+  std::string twice = data.substr(0, headerSize + entrySize) + data.substr(headerSize, entrySize);
+  uint64_t two = 2;
+  twice.replace(headerSize - sizeof(uint64_t), sizeof(uint64_t), (char const*)&two, sizeof(uint64_t));
+  std::stringstream twiceStream(twice);
+  threw = false;
+  try {
+    load(loadedSet, twiceStream);
+  } catch (std::runtime_error const&) {
+    threw = true;
+  }
+  assert(threw);
+
+  std::string huge = stream.str().substr(0, headerSize + sizeof(uint64_t));
+  uint64_t const hugeSize = (uint64_t)1 << 60;
+  huge.replace(headerSize - sizeof(uint64_t), sizeof(uint64_t), (char const*)&hugeSize, sizeof(uint64_t));
+  huge.append((char const*)&hugeSize, sizeof(uint64_t));
+  huge.append("abc");
+  std::stringstream hugeStream(huge);
+  threw = false;
+  try {
+    load(loaded, hugeStream);
+  } catch (std::runtime_error const&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+template <typename Hash>
+void test_frozen(int range) {
+  // Every key comes up twice, the first must win.
+  std::vector<std::pair<int, int>> values;
+  for (int i = 0; i < range * 2; ++i)
+    values.push_back({(i * 7919) % range, i});
+
+  frozen_hash_map<int, int, Hash> frozen(values.begin(), values.end());
+  hash_map<int, int, Hash> expected(values.begin(), values.end());
+  assert(frozen.size() == expected.size());
+  for (int i = -range; i < range * 2; ++i) {
+    assert(frozen.count(i) == expected.count(i));
+    if (expected.count(i))
+      assert(frozen.at(i) == expected.at(i) && frozen.find(i)->first == i);
+  }
+
+  size_t iterated = 0;
+  for (auto const& p : frozen) {
+    assert(expected.at(p.first) == p.second);
+    ++iterated;
+  }
+  assert(iterated == expected.size());
+  frozen_hash_map<int, int, Hash> rebuilt(frozen.begin(), frozen.end());
+  assert(rebuilt == frozen);
+
+  frozen_hash_map<int, int, Hash> empty;
+  assert(empty.empty() && empty.find(1) == empty.end());
+  frozen_hash_map<int, int, Hash> small = {{1, 2}, {3, 4}, {1, 5}};
+  assert(small.size() == 2 && small.at(1) == 2 && small.at(3) == 4 && small.count(2) == 0);
+}
+
+// Sends every key to one of four buckets, so that runs wrap around the end of
+// the table and values get shifted.
+struct ConstexprCollidingHash {
+  constexpr size_t operator()(int i) const {
+    return (size_t)(i % 4) - 4;
+  }
+};
+
+constexpr auto ConstexprOpcodes = make_constexpr_hash_map<char const*, int>({
+    {"add", 1}, {"sub", 2}, {"mul", 3}, {"div", 4}, {"mod", 5}, {"and", 6}, {"or", 7},
+    {"xor", 8}, {"not", 9}, {"shl", 10}, {"shr", 11}, {"jmp", 12}, {"add", 13}});
+
+static_assert(ConstexprOpcodes.size() == 12, "the repeated key is dropped");
+static_assert(ConstexprOpcodes.bucket_count() == 32, "12 values need 32 buckets at most 70% full");
+static_assert(ConstexprOpcodes.at("add") == 1, "the first of equal keys wins");
+static_assert(*ConstexprOpcodes.find("shr") == 11, "");
+static_assert(ConstexprOpcodes.find("nop") == nullptr && ConstexprOpcodes.count("ad") == 0, "");
+
+void test_constexpr() {
+  char const* names[] = {"add", "sub", "mul", "div", "mod", "and", "or", "xor", "not", "shl", "shr", "jmp"};
+  for (int i = 0; i < 12; ++i) {
+    // A copy of the name, so that lookups compare strings rather than pointers.
+    std::string name = names[i];
+    assert(ConstexprOpcodes.at(name.c_str()) == i + 1);
+  }
+  int sum = 0;
+  ConstexprOpcodes.for_each([&sum](char const*, int opcode) { sum += opcode; });
+  assert(sum == 78);
+
+  std::pair<int, int> values[200] = {};
+  for (int i = 0; i < 200; ++i)
+    values[i] = {(i * 37) % 100, i};
+  constexpr_hash_map<int, int, 200, ConstexprCollidingHash> colliding(values);
+  hash_map<int, int> expected(std::begin(values), std::end(values));
+  assert(colliding.size() == 100);
+  for (int i = -10; i < 110; ++i) {
+    assert(colliding.count(i) == expected.count(i));
+    if (expected.count(i))
+      assert(colliding.at(i) == expected.at(i));
+  }
+
+  // Strided integer keys are mixed, and land in the same buckets as in a
+  // hash_map of the same bucket count.
+  std::pair<int, int> strided[40] = {};
+  for (int i = 0; i < 40; ++i)
+    strided[i] = {i * 1024, i};
+  constexpr_hash_map<int, int, 40> stridedMap(strided);
+  hash_map<int, int> stridedExpected(std::begin(strided), std::end(strided));
+  stridedExpected.rehash(stridedMap.bucket_count());
+  assert(stridedExpected.bucket_count() == stridedMap.bucket_count());
+  auto next = stridedExpected.begin();
+  stridedMap.for_each([&next](int key, int mapped) {
+      assert(next->first == key && next->second == mapped);
+      ++next;
+    });
+  assert(next == stridedExpected.end());
+}
+
 int main(int argc, char** argv) {
     test_hash_set();
     test_hash_map();
+    test_layout<hash_set<int>>(5000);
+    test_layout<hash_set<int, CollidingHash>>(700);
+    test_control_layout();
+    test_compact_layout();
+    test_find_many();
+    test_transparent_lookup();
+    test_try_emplace();
+    test_growth();
+    test_hash_mixing();
+    test_stats();
+    test_probe_guard();
+    test_erase_if();
+    test_node_handles();
+    test_load_factor<hash_set<int>>();
+    test_load_factor<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, control_layout>>();
+    test_load_factor<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, compact_layout>>();
+    test_sparse_iteration<hash_set<int>>();
+    test_sparse_iteration<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, control_layout>>();
+    test_sparse_iteration<hash_set<int, std::hash<int>, std::equal_to<int>, std::allocator<int>, compact_layout>>();
+    test_allocator();
+    test_huge_page_allocator();
+#if defined(FLAT_HASH_PMR)
+    test_pmr();
+#endif
+    test_incremental<incremental_hash_map<int, int>>(5000);
+    test_incremental<incremental_hash_map<int, int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout>>(700);
+    test_incremental_aliased_keys();
+    test_concurrent();
+    test_read_mostly();
+    test_parallel_insert<hash_map<int, int>>();
+    test_parallel_insert<hash_map<int, int, ClusteredHash>>();
+    test_parallel_insert<hash_map<int, int, ClusteredHash, std::equal_to<int>, std::allocator<int>, control_layout>>();
+    test_parallel_insert<hash_map<int, int, std::hash<int>, std::equal_to<int>, std::allocator<int>, compact_layout>>();
+    test_mapped<hash_map<int, int>>("test_mapped.tmp");
+    test_mapped<hash_map<int, int, CollidingHash, std::equal_to<int>, std::allocator<int>, compact_layout>>("test_mapped.tmp");
+    test_serialization();
+    test_frozen<std::hash<int>>(20000);
+    test_frozen<CollidingHash>(300);
+    test_constexpr();
     std::cout << "tests passed!" << std::endl;
     return 0;
 }